@@ -8,9 +8,20 @@
 #define BUSTACHE_AST_HPP_INCLUDED
 
 #include <unordered_map>
+#include <memory_resource>
+#include <functional>
+#include <algorithm>
 #include <vector>
+#include <span>
 #include <string>
 #include <string_view>
+#include <cstdint>
+#include <cassert>
+
+namespace bustache
+{
+    struct format;
+}
 
 namespace bustache::ast
 {
@@ -25,7 +36,10 @@ namespace bustache::ast
         filter,
         loop,
         inheritance,
-        partial
+        partial,
+        // A block whose output is kept in a fragment_cache, after the rest so
+        // that the images made before it stay valid.
+        cache
     };
 
     struct content
@@ -38,43 +52,203 @@ namespace bustache::ast
 
     using text = std::string_view;
 
-    using content_list = std::vector<content>;
+    using content_list = std::pmr::vector<content>;
+
+    // Allows lookup by std::string_view.
+    struct key_hash
+    {
+        using is_transparent = void;
+
+        std::size_t operator()(std::string_view key) const noexcept
+        {
+            return std::hash<std::string_view>{}(key);
+        }
+    };
 
-    using override_map = std::unordered_map<std::string, content_list>;
+    // Refers to a key in the pool of the context, see context::key.
+    using key_id = std::uint32_t;
+
+    // An absent key_id or index.
+    constexpr std::uint32_t npos = ~std::uint32_t(0);
+
+    // The dot-separated parts of a name stored in context::paths, a name
+    // relative to the current value (e.g. `.a.b`) starts with an empty part.
+    struct path_ref
+    {
+        std::uint32_t offset = 0;
+        std::uint32_t size = 0;
+    };
 
     struct variable
     {
-        std::string key;
+        key_id key;
         unsigned split;
+        path_ref path = {}; // If empty, `key` is split when rendered.
+    };
+
+    // A list of contents stored in context::lists.
+    struct list_ref
+    {
+        std::uint32_t offset;
+        std::uint32_t size;
     };
 
     struct block
     {
-        std::string key;
-        content_list contents;
+        key_id key;
+        list_ref contents;
+        path_ref path = {}; // Not used by inheritance blocks.
     };
 
+    // The offsets of the newlines in a text stored in context::newlines.
+    struct newline_ref
+    {
+        std::uint32_t offset;
+        std::uint32_t size;
+    };
+
+    // A `{{$block}}` within `{{<partial}}`, which overrides the block of
+    // the same name in the partial.
+    struct overrider
+    {
+        key_id key;
+        list_ref contents;
+    };
+
+    // The overriders of a partial, sorted by name, which is unique (the
+    // first one in the source wins), see context::find_overrider.
+    using override_map = std::pmr::vector<overrider>;
+
     struct partial
     {
-        std::string key;
-        std::string indent;
-        override_map overriders;
+        key_id key;
+        key_id indent = npos;
+        std::uint32_t overriders = npos; // Index into context::overriders.
     };
 
+    // All the nodes are allocated from the memory resource the context is
+    // constructed with, a copy uses the default one.
     struct context
     {
-        std::vector<text> texts;
-        std::vector<variable> variables;
-        std::vector<block> blocks;
-        std::vector<partial> partials;
+        using allocator_type = std::pmr::polymorphic_allocator<>;
+
+        std::pmr::vector<text> texts;
+        std::pmr::vector<variable> variables;
+        std::pmr::vector<block> blocks;
+        std::pmr::vector<partial> partials;
+        std::pmr::vector<override_map> overriders;
+        // The contents of all blocks, each one contiguous.
+        std::pmr::vector<content> lists;
+        std::pmr::vector<key_id> paths;
+        // The characters of all keys, each one null-terminated. Key `id`
+        // ends at key_ends[id] and starts after the end of the previous one.
+        std::pmr::string key_chars;
+        std::pmr::vector<std::uint32_t> key_ends;
+        // The format each partial is linked to, or null if it's looked up
+        // in the context when rendered, see bustache::link.
+        std::pmr::vector<format const*> links;
+        // The newlines of each text, except one that ends it, so a text can
+        // be indented without scanning it, see index_newlines.
+        std::pmr::vector<newline_ref> text_newlines;
+        std::pmr::vector<std::uint32_t> newlines;
+
+        context() = default;
+
+        explicit context(allocator_type alloc)
+            : texts(alloc), variables(alloc), blocks(alloc), partials(alloc)
+            , overriders(alloc), lists(alloc), paths(alloc), key_chars(alloc)
+            , key_ends(alloc), links(alloc), text_newlines(alloc), newlines(alloc)
+        {}
+
+        allocator_type get_allocator() const noexcept
+        {
+            return texts.get_allocator();
+        }
+
+        key_id add_key(std::string_view key)
+        {
+            key_chars.append(key);
+            key_ends.push_back(std::uint32_t(key_chars.size()));
+            key_chars.push_back('\0');
+            return key_id(key_ends.size() - 1);
+        }
+
+        std::string_view key(key_id id) const noexcept
+        {
+            auto const begin = id ? key_ends[id - 1] + 1 : 0u;
+            return std::string_view(key_chars.data() + begin, key_ends[id] - begin);
+        }
+
+        std::span<key_id const> path(path_ref ref) const noexcept
+        {
+            return {paths.data() + ref.offset, ref.size};
+        }
+
+        list_ref add_list(std::span<content const> contents)
+        {
+            list_ref ret{std::uint32_t(lists.size()), std::uint32_t(contents.size())};
+            lists.insert(lists.end(), contents.begin(), contents.end());
+            return ret;
+        }
+
+        std::span<content const> list(list_ref ref) const noexcept
+        {
+            return {lists.data() + ref.offset, ref.size};
+        }
 
         content add(text node)
         {
             content ret{type::text, unsigned(texts.size())};
             texts.push_back(node);
+            index_newlines();
             return ret;
         }
 
+        // Index the texts added without `add`.
+        void index_newlines()
+        {
+            for (auto i = text_newlines.size(); i < texts.size(); ++i)
+            {
+                auto const t = texts[i];
+                newline_ref ref{std::uint32_t(newlines.size()), 0};
+                for (auto pos = t.find('\n'); pos < t.size() - 1; pos = t.find('\n', pos + 1))
+                    newlines.push_back(std::uint32_t(pos));
+                ref.size = std::uint32_t(newlines.size() - ref.offset);
+                text_newlines.push_back(ref);
+            }
+        }
+
+        // The text must be indexed.
+        std::span<std::uint32_t const> newlines_of(std::size_t index) const noexcept
+        {
+            assert(index < text_newlines.size() && "the text isn't indexed, see index_newlines");
+            auto const ref = text_newlines[index];
+            return {newlines.data() + ref.offset, ref.size};
+        }
+
+        // Call `f` with the position of each newline of the text, except one
+        // that ends it. A text not indexed yet is scanned instead.
+        template<class F>
+        void for_each_newline(std::size_t index, F&& f) const
+        {
+            if (index < text_newlines.size())
+            {
+                for (auto const pos : newlines_of(index))
+                    f(pos);
+                return;
+            }
+            auto const t = texts[index];
+            for (auto pos = t.find('\n'); pos < t.size() - 1; pos = t.find('\n', pos + 1))
+                f(std::uint32_t(pos));
+        }
+
+        overrider const* find_overrider(override_map const& map, std::string_view name) const noexcept
+        {
+            auto const it = std::partition_point(map.begin(), map.end(),
+                [&](overrider const& o) { return key(o.key) < name; });
+            return it != map.end() && key(it->key) == name ? &*it : nullptr;
+        }
+
         content add(type kind, variable&& node)
         {
             content ret{kind, unsigned(variables.size())};
@@ -112,6 +286,7 @@ namespace bustache::ast
             case type::filter:
             case type::loop:
             case type::inheritance:
+            case type::cache:
                 return f(c.kind, blocks.data() + c.index);
             case type::partial: return f(c.kind, partials.data() + c.index);
             }
@@ -122,12 +297,16 @@ namespace bustache::ast
     {
         context ctx;
         content_list contents;
+
+        document() = default;
+
+        explicit document(context::allocator_type alloc) : ctx(alloc), contents(alloc) {}
     };
 
     struct view
     {
         context const& ctx;
-        content_list const& contents;
+        std::span<content const> contents;
     };
 }
 
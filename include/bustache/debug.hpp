@@ -23,6 +23,7 @@ namespace bustache::detail
         case ast::type::filter: return "(?)";
         case ast::type::loop: return "(*)";
         case ast::type::inheritance: return "($)";
+        case ast::type::cache: return "(@)";
         }
         return "";
     }
@@ -71,22 +72,22 @@ namespace bustache::detail
         {
             indent();
             out << "variable" << get_tag_str(tag);
-            out << ": " << variable->key << "\n";
+            out << ": " << ctx.key(variable->key) << "\n";
         }
 
         void operator()(ast::type tag, ast::block const* block)
         {
-            out << "section" << get_tag_str(tag) << ": " << block->key << "\n";
+            out << "section" << get_tag_str(tag) << ": " << ctx.key(block->key) << "\n";
             ++level;
-            for (auto const& content : block->contents)
+            for (auto const& content : ctx.list(block->contents))
                 ctx.visit(*this, content);
             --level;
         }
 
         void operator()(ast::type, ast::partial const* partial) const
         {
-            out << "partial: " << partial->key << ", indent: ";
-            write_text(partial->indent);
+            out << "partial: " << ctx.key(partial->key) << ", indent: ";
+            write_text(partial->indent == ast::npos ? std::string_view() : ctx.key(partial->indent));
             out << "\n";
         }
 
@@ -0,0 +1,359 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef BUSTACHE_DETAIL_PARSE_CORE_HPP_INCLUDED
+#define BUSTACHE_DETAIL_PARSE_CORE_HPP_INCLUDED
+
+#include <string>
+#include <cstddef>
+#include <string_view>
+#include <bustache/format.hpp>
+
+// The reading of tags and the standalone rules, shared by the parser in
+// src/format.cpp and the constexpr one of static_format. The byte scanning
+// is left to `Scan`, which is plain_scan in constant evaluation and the
+// runtime-dispatched kernels otherwise.
+namespace bustache::detail::parse_core
+{
+    using I = char const*;
+
+    struct delim
+    {
+        std::string_view open;
+        std::string_view close;
+    };
+
+    constexpr bool is_space(char c)
+    {
+        switch (c)
+        {
+        case ' ':
+        case '\f':
+        case '\n':
+        case '\r':
+        case '\t':
+        case '\v':
+            return true;
+        }
+        return false;
+    }
+
+    // The scanning primitives as plain loops, see parser::kernel_table.
+    struct plain_scan
+    {
+        static constexpr I skip_space(I i, I e) noexcept
+        {
+            while (i != e && is_space(*i))
+                ++i;
+            return i;
+        }
+
+        static constexpr I find_either(I i, I e, char a, char b) noexcept
+        {
+            while (i != e && *i != a && *i != b)
+                ++i;
+            return i;
+        }
+
+        static constexpr I find_key_stop(I i, I e, char a, char b) noexcept
+        {
+            while (i != e && *i != a && *i != b && *i != ':' && !is_space(*i))
+                ++i;
+            return i;
+        }
+    };
+
+    constexpr bool parse_lit(I& i, I e, std::string_view str) noexcept
+    {
+        if (e - i < std::ptrdiff_t(str.size()))
+            return false;
+        I p = i;
+        for (char c : str)
+        {
+            if (*p != c)
+                return false;
+            ++p;
+        }
+        i = p;
+        return true;
+    }
+
+    struct pure_result
+    {
+        I start;
+        bool standalone;
+    };
+
+    constexpr pure_result process_pure(I& i, I e, bool pure) noexcept
+    {
+        pure_result ret{i, pure};
+        if (pure)
+        {
+            while (i != e)
+            {
+                if (*i == '\n')
+                {
+                    ret.start = ++i;
+                    break;
+                }
+                else if (is_space(*i))
+                    ++i;
+                else
+                {
+                    ret.standalone = false;
+                    break;
+                }
+            }
+        }
+        return ret;
+    }
+
+    // Skip the rest of the line if it's blank, return false otherwise.
+    constexpr bool skip_blank_line(I& i, I e) noexcept
+    {
+        while (i != e)
+        {
+            if (*i == '\n')
+            {
+                ++i;
+                break;
+            }
+            if (!is_space(*i))
+                return false;
+            ++i;
+        }
+        return true;
+    }
+
+    enum class tag_kind
+    {
+        variable,
+        block,
+        inheritance,
+        end_section,
+        partial,
+        comment,
+        set_delim
+    };
+
+    // A tag that has been read but not yet applied to the AST.
+    struct tag
+    {
+        tag_kind what{};
+        ast::type kind{};
+        unsigned split = 0;
+        std::string key;
+        delim new_delim;
+    };
+
+    template<class Scan>
+    struct lexer
+    {
+        // Return true if it ends.
+        static constexpr bool skip(I& i, I e) noexcept
+        {
+            i = Scan::skip_space(i, e);
+            return i == e;
+        }
+
+        static constexpr bool parse_sentinel(I& i, I e, char c) noexcept
+        {
+            if (i != e && *i == c)
+            {
+                skip(++i, e);
+                return true;
+            }
+            return false;
+        }
+
+        static constexpr void parse_dyn_sigil(I& i, I e, std::string& key)
+        {
+            skip(i, e);
+            if (i != e && *i == '*')
+            {
+                key = '*';
+                ++i;
+            }
+        }
+
+        static constexpr unsigned expect_key(I b, I& i, I e, delim const& d, std::string& key, char sentinel)
+        {
+            unsigned split = 0;
+            skip(i, e);
+            // Bytes other than spaces, ':', the sentinel and the start of the
+            // close delimiter are just part of the key.
+            auto const c = d.close.front();
+            auto const s = sentinel ? sentinel : c;
+            for (I const i0 = i; (i = Scan::find_key_stop(i, e, c, s)) != e; ++i)
+            {
+                I const i1 = i;
+                if (is_space(*i)) [[unlikely]]
+                    skip(++i, e);
+                if (!sentinel || parse_sentinel(i, e, sentinel))
+                {
+                    if (parse_lit(i, e, d.close))
+                    {
+                        if (split ? split + 1 == i1 - i0 : i0 == i1) [[unlikely]]
+                            break;
+                        key.append(i0, i1);
+                        return split;
+                    }
+                }
+                if (i == e) [[unlikely]]
+                    break;
+                if (!split && *i == ':')
+                {
+                    split = unsigned(i - i0);
+                    if (!split) [[unlikely]]
+                        break;
+                }
+            }
+            throw format_error(error_badkey, i - b);
+        }
+
+        static constexpr void expect_comment(I b, I& i, I e, delim const& d)
+        {
+            auto const c = d.close.front();
+            while ((i = Scan::find_either(i, e, c, d.open.front())) != e)
+            {
+                if (parse_lit(i, e, d.close))
+                    return;
+                if (parse_lit(i, e, d.open))
+                {
+                    while (!parse_lit(i = Scan::find_either(i, e, c, c), e, d.close))
+                    {
+                        if (i == e)
+                            throw format_error(error_delim, i - b);
+                        ++i;
+                    }
+                }
+                else
+                    ++i;
+            }
+            throw format_error(error_delim, i - b);
+        }
+
+        static constexpr delim expect_set_delim(I b, I& i, I e, delim const& d)
+        {
+            delim ret;
+            skip(i, e);
+            I i0 = i;
+            for (;;)
+            {
+                if (i == e)
+                    throw format_error(error_baddelim, i - b);
+                if (is_space(*i))
+                    break;
+                ++i;
+            }
+            ret.open = std::string_view(i0, static_cast<std::size_t>(i - i0));
+            skip(i, e);
+            i0 = i;
+            I i1 = i;
+            for (;; ++i)
+            {
+                if (i == e)
+                    throw format_error(error_set_delim, i - b);
+                if (*i == '=')
+                {
+                    i1 = i;
+                    break;
+                }
+                if (is_space(*i))
+                {
+                    i1 = i;
+                    if (skip(++i, e) || *i != '=')
+                        throw format_error(error_set_delim, i - b);
+                    break;
+                }
+            }
+            if (i0 == i1)
+                throw format_error(error_baddelim, i - b);
+            skip(++i, e);
+            if (!parse_lit(i, e, d.close))
+                throw format_error(error_delim, i - b);
+            ret.close = std::string_view(i0, static_cast<std::size_t>(i1 - i0));
+            return ret;
+        }
+
+        // Read the tag after an open delimiter, `section` is the name an end
+        // section tag must match.
+        static constexpr tag read_tag(I b, I& i, I e, delim const& d, std::string_view section)
+        {
+            if (skip(i, e))
+                throw format_error(error_badkey, i - b);
+            tag ret{};
+            switch (*i)
+            {
+            case '#':
+                ret.kind = ast::type::section;
+                break;
+            case '^':
+                ret.kind = ast::type::inversion;
+                break;
+            case '?':
+                ret.kind = ast::type::filter;
+                break;
+            case '*':
+                ret.kind = ast::type::loop;
+                break;
+            case '@':
+                ret.kind = ast::type::cache;
+                break;
+            case '$':
+                ret.kind = ast::type::inheritance;
+                break;
+            case '/':
+                skip(++i, e);
+                if (!parse_lit(i, e, section))
+                    throw format_error(error_section, i - b);
+                skip(i, e);
+                if (!parse_lit(i, e, d.close))
+                    throw format_error(error_delim, i - b);
+                ret.what = tag_kind::end_section;
+                return ret;
+            case '!':
+                expect_comment(b, ++i, e, d);
+                ret.what = tag_kind::comment;
+                return ret;
+            case '=':
+                ret.new_delim = expect_set_delim(b, ++i, e, d);
+                ret.what = tag_kind::set_delim;
+                return ret;
+            case '>':
+                parse_dyn_sigil(++i, e, ret.key);
+                expect_key(b, i, e, d, ret.key, '\0');
+                ret.what = tag_kind::partial;
+                return ret;
+            case '&':
+            case '{':
+            {
+                char const sentinel = *i == '{' ? '}' : '\0';
+                ret.split = expect_key(b, ++i, e, d, ret.key, sentinel);
+                ret.what = tag_kind::variable;
+                ret.kind = ast::type::var_raw;
+                return ret;
+            }
+            // Extensions
+            case '<':
+                parse_dyn_sigil(++i, e, ret.key);
+                expect_key(b, i, e, d, ret.key, '\0');
+                ret.what = tag_kind::inheritance;
+                return ret;
+            default:
+                ret.split = expect_key(b, i, e, d, ret.key, '\0');
+                ret.what = tag_kind::variable;
+                ret.kind = ast::type::var_escaped;
+                return ret;
+            }
+            ret.split = expect_key(b, ++i, e, d, ret.key, '\0');
+            ret.what = tag_kind::block;
+            return ret;
+        }
+    };
+}
+
+#endif
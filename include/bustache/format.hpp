@@ -27,9 +27,24 @@
 namespace bustache
 {
     struct format;
+    class render_state;
+    class fragment_cache;
+
+    // How a format is rendered.
+    enum class render_engine
+    {
+        // Walk the document.
+        tree,
+        // Run the bytecode of the format, see format::compile.
+        bytecode
+    };
 
     namespace detail
     {
+        struct source_map;
+        struct linker;
+        struct program;
+
         template<class T>
         struct manip_core
         {
@@ -48,6 +63,33 @@ namespace bustache
         {
             T const& escape;
         };
+
+        struct manip_engine
+        {
+            render_engine engine;
+        };
+
+        struct manip_state
+        {
+            render_state& state;
+        };
+
+        struct manip_fragments
+        {
+            fragment_cache& fragments;
+        };
+
+        // Returns the text of a format to the resource it came from.
+        struct text_deleter
+        {
+            std::pmr::memory_resource* resource = nullptr;
+            std::size_t size = 0;
+
+            void operator()(char* p) const noexcept
+            {
+                resource->deallocate(p, size, 1);
+            }
+        };
     }
 
     template<class... Opts>
@@ -64,6 +106,21 @@ namespace bustache
         {
             return {static_cast<Opts const&>(*this)..., {escape_}};
         }
+
+        manipulator<Opts..., detail::manip_engine> engine(render_engine engine_) const noexcept
+        {
+            return {static_cast<Opts const&>(*this)..., {engine_}};
+        }
+
+        manipulator<Opts..., detail::manip_state> state(render_state& state_) const noexcept
+        {
+            return {static_cast<Opts const&>(*this)..., {state_}};
+        }
+
+        manipulator<Opts..., detail::manip_fragments> fragments(fragment_cache& fragments_) const noexcept
+        {
+            return {static_cast<Opts const&>(*this)..., {fragments_}};
+        }
     };
 
     enum error_type
@@ -87,6 +144,48 @@ namespace bustache
         std::ptrdiff_t position() const noexcept { return _pos; }
     };
 
+    enum class parser_kernel
+    {
+        automatic,
+        scalar,
+        swar,
+        sse42,
+        avx2
+    };
+
+    // Select the byte-scanning kernels used by the parser, `automatic` picks
+    // the best one the CPU supports (which is also the initial setting).
+    // Returns false if the CPU doesn't support the requested kernels.
+    BUSTACHE_API bool set_parser_kernel(parser_kernel kind) noexcept;
+
+    // Return the kernels currently in use, never `automatic`.
+    BUSTACHE_API parser_kernel get_parser_kernel() noexcept;
+
+    // Tag for constructing a format that keeps its source, see format::edit.
+    struct editable_t {};
+    constexpr editable_t editable{};
+
+    // Replace `length` bytes of the source at `offset` with `text`.
+    struct source_edit
+    {
+        std::size_t offset;
+        std::size_t length;
+        std::string_view text;
+    };
+
+    // The passes format::optimize runs, in the order listed.
+    struct optimize_options
+    {
+        // Remove sections, inversions, filters and loops without contents.
+        // Off by default, since a lambda bound to such a section would then
+        // not be called.
+        bool prune_empty = false;
+        // Merge adjacent texts, e.g. those around a comment.
+        bool coalesce_text = true;
+        // Drop the nodes and keys no longer reachable from the document.
+        bool compact = true;
+    };
+
     struct format
     {
         format() = default;
@@ -103,16 +202,38 @@ namespace bustache
                 copy_text(text_size());
         }
 
+        // Allocate the document, and the text if `copytext`, from `resource`
+        // which must outlive the format. A copy uses the default resource.
+        format(std::string_view source, bool copytext, std::pmr::memory_resource* resource)
+          : _doc(resource)
+        {
+            init(source.data(), source.data() + source.size());
+            if (copytext)
+                copy_text(text_size());
+        }
+
+        format(std::string_view source, editable_t)
+        {
+            init_editable(source);
+        }
+
+        format(std::string_view source, optimize_options const& opts)
+        {
+            init(source.data(), source.data() + source.size());
+            optimize(opts);
+        }
+
         format(ast::document doc, bool copytext)
           : _doc(std::move(doc))
         {
+            _doc.ctx.index_newlines();
             if (copytext)
                 copy_text(text_size());
         }
 
         format(format&& other) = default;
 
-        format(format const& other) : _doc(other._doc)
+        format(format const& other) : _doc(other._doc), _source(other._source), _program(other._program)
         {
             if (other._text)
                 copy_text(text_size());
@@ -135,14 +256,76 @@ namespace bustache
         {
             return _doc;
         }
-        
+
+        std::pmr::memory_resource* resource() const noexcept
+        {
+            return _doc.ctx.get_allocator().resource();
+        }
+
+        // Apply `e` to the source of an `editable` format and re-parse only
+        // the top-level contents it affects, the rest of the document is
+        // kept as is. If the new source is ill-formed, format_error is thrown
+        // and the format is left unchanged.
+        BUSTACHE_API void edit(source_edit const& e);
+
+        // The source of an `editable` format, empty otherwise.
+        BUSTACHE_API std::string_view source() const noexcept;
+
+        // Rewrite the document with the passes enabled in `opts`, it renders
+        // the same afterwards. The format then owns its text and is no longer
+        // editable.
+        BUSTACHE_API void optimize(optimize_options const& opts = {});
+
+        // Compile the document to the bytecode used by render_engine::bytecode,
+        // which otherwise compiles it for each render. An edit or optimize
+        // discards it.
+        BUSTACHE_API void compile();
+
+        bool compiled() const noexcept
+        {
+            return !!_program;
+        }
+
     private:
+        friend class format_builder;
+        friend struct detail::linker;
+
         BUSTACHE_API void init(char const* begin, char const* end);
+        BUSTACHE_API void init_editable(std::string_view source);
         BUSTACHE_API std::size_t text_size() const noexcept;
         BUSTACHE_API void copy_text(std::size_t n);
 
         ast::document _doc;
-        std::unique_ptr<char[]> _text;
+        std::unique_ptr<char[], detail::text_deleter> _text;
+        // Shared by copies, an edit makes a new one.
+        std::shared_ptr<detail::source_map const> _source;
+        // Shared by copies, see compile.
+        std::shared_ptr<detail::program const> _program;
+    };
+
+    // Build a format from a template that arrives in pieces, e.g. read from
+    // a stream. Each chunk is parsed as far as it can be when it's fed, only
+    // the undecided tail (at most a partial line or tag) is kept around, and
+    // the static text is copied once into the storage owned by the result.
+    class format_builder
+    {
+    public:
+        BUSTACHE_API format_builder();
+        BUSTACHE_API format_builder(format_builder&& other) noexcept;
+        BUSTACHE_API format_builder& operator=(format_builder&& other) noexcept;
+        BUSTACHE_API ~format_builder();
+
+        // Throw format_error as soon as the input seen so far is known to
+        // be ill-formed, with the position counted from the first chunk.
+        BUSTACHE_API void feed(std::string_view chunk);
+
+        // Parse the rest and return the result, the builder is left empty
+        // and can be reused for another template.
+        BUSTACHE_API format finish();
+
+    private:
+        struct impl;
+        std::unique_ptr<impl> _impl;
     };
 
     inline namespace literals
@@ -0,0 +1,105 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef BUSTACHE_FRAGMENT_CACHE_HPP_INCLUDED
+#define BUSTACHE_FRAGMENT_CACHE_HPP_INCLUDED
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <bustache/model.hpp>
+
+namespace bustache
+{
+    // Where the output of the cached sections (i.e. `{{@key}}`) is kept
+    // between renders. A fragment is identified by a 64-bit hash of the
+    // name and the contents of its section and of the overriders in effect
+    // for the inheritance blocks (i.e. `{{$block}}`), as `id`, and by the
+    // printed value of its key, which must be an atom (otherwise it's not
+    // cached). Neither the escape action nor the context is part of it, so
+    // a cache must only be shared by renders that use the same escape
+    // action and give the same partials for the names within the cached
+    // sections (e.g. one cache per escape action), and two different
+    // sections whose ids collide, however unlikely, share their output.
+    // It's used by any number of renders at a time.
+    class fragment_cache
+    {
+    public:
+        virtual ~fragment_cache() = default;
+
+        // Write the output kept for the fragment to `os` and return true, or
+        // return false if there's none.
+        virtual bool load(std::uint64_t id, std::string_view key, output_handler os) = 0;
+
+        // Keep the output of the fragment, just rendered.
+        virtual void store(std::uint64_t id, std::string_view key, std::string_view output) = 0;
+    };
+
+    // A fragment_cache that keeps the outputs up to `capacity` bytes in
+    // total, dropping the least recently used ones to make room.
+    class lru_fragment_cache : public fragment_cache
+    {
+    public:
+        BUSTACHE_API explicit lru_fragment_cache(std::size_t capacity);
+
+        BUSTACHE_API bool load(std::uint64_t id, std::string_view key, output_handler os) override;
+
+        BUSTACHE_API void store(std::uint64_t id, std::string_view key, std::string_view output) override;
+
+        BUSTACHE_API void clear();
+
+        // The bytes kept, counting the keys.
+        BUSTACHE_API std::size_t size() const;
+
+        std::size_t capacity() const noexcept { return _capacity; }
+
+        std::uint64_t hits() const noexcept { return _hits.load(std::memory_order_relaxed); }
+
+        std::uint64_t misses() const noexcept { return _misses.load(std::memory_order_relaxed); }
+
+    private:
+        struct entry
+        {
+            std::uint64_t id;
+            std::string key;
+            // Shared with the loads in progress, which write it unlocked.
+            std::shared_ptr<std::string const> output;
+        };
+
+        struct entry_key
+        {
+            std::uint64_t id;
+            std::string_view key;
+
+            bool operator==(entry_key const&) const = default;
+        };
+
+        struct entry_hash
+        {
+            std::size_t operator()(entry_key const& k) const noexcept
+            {
+                return std::hash<std::string_view>{}(k.key) ^ std::hash<std::uint64_t>{}(k.id);
+            }
+        };
+
+        std::size_t const _capacity;
+        mutable std::mutex _mutex;
+        // Most recently used first.
+        std::list<entry> _entries;
+        // The keys refer to `_entries`.
+        std::unordered_map<entry_key, std::list<entry>::iterator, entry_hash> _map;
+        std::size_t _size = 0;
+        std::atomic<std::uint64_t> _hits{0};
+        std::atomic<std::uint64_t> _misses{0};
+    };
+}
+
+#endif
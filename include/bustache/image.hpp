@@ -0,0 +1,39 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef BUSTACHE_IMAGE_HPP_INCLUDED
+#define BUSTACHE_IMAGE_HPP_INCLUDED
+
+#include <string>
+#include <string_view>
+#include <bustache/format.hpp>
+
+namespace bustache
+{
+    // Thrown when an image is malformed, or was saved by an incompatible
+    // version of the library or on a machine of different byte order.
+    class image_error : public std::runtime_error
+    {
+    public:
+        using runtime_error::runtime_error;
+    };
+
+    // Serialize the document of `fmt` into a binary image. It holds offsets
+    // instead of pointers, so it can be stored and loaded anywhere.
+    BUSTACHE_API std::string save_image(format const& fmt);
+
+    // Load a format from an image made by save_image without parsing it.
+    // Unless `copytext` is set, the texts refer to `image` directly, which
+    // must then outlive the format, e.g. it can be a mmap'ed file. The
+    // document, and the text if copied, is allocated from `resource`.
+    BUSTACHE_API format load_image
+    (
+        std::string_view image, bool copytext,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+    );
+}
+
+#endif
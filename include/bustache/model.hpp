@@ -471,12 +471,16 @@ namespace bustache::detail
 
     struct object_trait
     {
-        constexpr object_trait(...) : get(get_default) {}
+        constexpr object_trait(...) : get(get_default), fixed_keys(true) {}
 
         template<class T> requires requires{impl_object<T>{};}
-        constexpr object_trait(type<T>) : get(get_impl<T>) {}
+        constexpr object_trait(type<T>)
+            : get(get_impl<T>), fixed_keys(requires{requires impl_object<T>::fixed_keys;})
+        {}
 
         void(*get)(void const* self, std::string_view key, value_handler visit);
+        // Whether `get` misses a key for every instance once it does for one.
+        bool fixed_keys;
 
         static void get_default(void const*, std::string_view, value_handler visit)
         {
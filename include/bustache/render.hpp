@@ -8,12 +8,16 @@
 #define BUSTACHE_RENDER_HPP_INCLUDED
 
 #include <bustache/model.hpp>
+#include <memory>
 #include <optional>
 #include <span>
+#include <string>
 #include <string_view>
 
 namespace bustache
 {
+    class fragment_cache;
+
     using unresolved_handler = fn_ptr<value_ptr(std::string_view)>;
 
     using context_handler = fn_ref<std::optional<std::reference_wrapper<format const>>(std::string_view)>;
@@ -61,6 +65,110 @@ namespace bustache
     {
         return detail::get_context(&manip);
     }
+
+    namespace detail
+    {
+        constexpr render_engine get_engine(void const*)
+        {
+            return render_engine::tree;
+        }
+
+        constexpr render_engine get_engine(manip_engine const* p)
+        {
+            return p->engine;
+        }
+    }
+
+    template<class... Opts>
+    constexpr render_engine get_engine(manipulator<Opts...> const& manip)
+    {
+        return detail::get_engine(&manip);
+    }
+
+    namespace detail
+    {
+        constexpr render_state* get_state(void const*)
+        {
+            return nullptr;
+        }
+
+        constexpr render_state* get_state(manip_state const* p)
+        {
+            return &p->state;
+        }
+
+        constexpr fragment_cache* get_fragments(void const*)
+        {
+            return nullptr;
+        }
+
+        constexpr fragment_cache* get_fragments(manip_fragments const* p)
+        {
+            return &p->fragments;
+        }
+    }
+
+    template<class... Opts>
+    constexpr render_state* get_state(manipulator<Opts...> const& manip)
+    {
+        return detail::get_state(&manip);
+    }
+
+    template<class... Opts>
+    constexpr fragment_cache* get_fragments(manipulator<Opts...> const& manip)
+    {
+        return detail::get_fragments(&manip);
+    }
+
+    // Look up every partial of `fmt` whose name isn't dynamic in `context`
+    // once and keep the result, rendering `fmt` then doesn't ask the context
+    // for them whatever context is given. Those not found are still looked
+    // up when rendered. The linked formats must outlive `fmt` and its copies.
+    BUSTACHE_API void link(format& fmt, context_handler context);
+
+    // Make a format where the partials of `fmt` are replaced with the
+    // contents of the formats `context` gives for them, with their indent
+    // already applied, and likewise for their partials. It renders the same
+    // as `fmt` with `context`, except that the output of a lambda is not
+    // indented. A partial with overriders (i.e. `{{<parent}}`) is replaced
+    // likewise, with its overriders in place of the blocks they override.
+    // A partial is kept if its name is dynamic, it's not found, it's
+    // recursive, or (inside an indented partial) the indent of its contents
+    // depends on the data, it then takes the overriders in effect as its
+    // own. The blocks in the output of a lambda aren't overridden by those
+    // of the partials replaced.
+    BUSTACHE_API format inline_partials(format const& fmt, context_handler context);
+
+    // Like inline_partials, but only replace the partials with overriders,
+    // so that a template using a layout renders as one flat template.
+    BUSTACHE_API format resolve_inheritance(format const& fmt, context_handler context);
+
+    namespace detail
+    {
+        struct render_buffers;
+    }
+
+    // The buffers a render works with, which keep their capacity for the
+    // next render given the same state, so that it doesn't allocate once
+    // they're big enough. A state is used by one render at a time, a render
+    // within a render (e.g. by a lambda) given the same one uses fresh
+    // buffers instead. Without a state, a render uses its thread's own.
+    // The buffers are allocated from the resource the state is constructed
+    // with, which must outlive it.
+    class render_state
+    {
+    public:
+        BUSTACHE_API render_state();
+        BUSTACHE_API explicit render_state(std::pmr::memory_resource* resource);
+        BUSTACHE_API render_state(render_state&& other) noexcept;
+        BUSTACHE_API render_state& operator=(render_state&& other) noexcept;
+        BUSTACHE_API ~render_state();
+
+    private:
+        friend struct detail::linker;
+
+        std::unique_ptr<detail::render_buffers> _buffers;
+    };
 }
 
 namespace bustache::detail
@@ -119,10 +227,24 @@ namespace bustache::detail
         }
     };
 
+    // Forwards the output of a render to `to`, which is redirected to record
+    // that of a cached fragment, escaped or not.
+    struct output_switch
+    {
+        output_handler to;
+
+        void operator()(std::span<const char> data) const
+        {
+            to(data);
+        }
+    };
+
+    // `out` is that of `raw_os` and `escape_os`, if `fragments` is given.
     BUSTACHE_API void render
     (
         output_handler raw_os, output_handler escape_os, format const& fmt, value_ptr data,
-        context_handler context, unresolved_handler f
+        context_handler context, unresolved_handler f, render_engine engine,
+        render_state* state, fragment_cache* fragments, output_switch* out
     );
 }
 
@@ -163,15 +285,71 @@ namespace bustache
         return detail::get_escape(&manip);
     }
 
+    namespace detail
+    {
+        template<class Sink, class Escape>
+        inline void render_sink
+        (
+            Sink const& os, format const& fmt, value_ptr data,
+            context_handler context, Escape const& escape, unresolved_handler f,
+            render_engine engine, render_state* state, fragment_cache* fragments
+        )
+        {
+            if (!fragments)
+                return render(os, escape(os), fmt, data, context, f, engine, state, nullptr, nullptr);
+            output_switch out{os};
+            render(out, escape(out), fmt, data, context, f, engine, state, fragments, &out);
+        }
+    }
+
     template<class Sink, class Escape = no_escape_t>
     inline void render
     (
         Sink const& os, format const& fmt, value_ref data,
         context_handler context = no_context_t{}, Escape escape = {},
-        unresolved_handler f = nullptr
+        unresolved_handler f = nullptr, render_engine engine = render_engine::tree
     )
     {
-        detail::render(os, escape(os), fmt, data.get_ptr(), context, f);
+        detail::render_sink(os, fmt, data.get_ptr(), context, escape, f, engine, nullptr, nullptr);
+    }
+
+    // Render with the options of `manip`, including those only given that
+    // way, i.e. the render state and the fragment cache.
+    template<class Sink, class... Opts>
+    inline void render(Sink const& os, manipulator<Opts...> const& manip)
+    {
+        detail::render_sink
+        (
+            os, manip.fmt, value_ref(manip.data).get_ptr(), get_context(manip), get_escape(manip),
+            nullptr, get_engine(manip), get_state(manip), get_fragments(manip)
+        );
+    }
+
+    namespace detail
+    {
+        BUSTACHE_API format fold_constants
+        (
+            output_handler raw_os, output_handler escape_os, std::string& folded,
+            format const& fmt, value_ptr constants
+        );
+    }
+
+    // Make a format where the variables and sections of `fmt` whose names
+    // are found in `constants` are replaced with what they render, i.e. the
+    // lists are unrolled, with the variables escaped by `escape`. It renders
+    // the same as `fmt` given data with the same values for those names.
+    // The nodes whose output may depend on the rest of the data are kept,
+    // e.g. those within a section on it, the partials and the lambdas, so
+    // the data still needs the constants they refer to, if any.
+    template<class Escape = no_escape_t>
+    inline format fold_constants(format const& fmt, value_ref constants, Escape escape = {})
+    {
+        std::string folded;
+        auto const os = [&folded](std::span<const char> data)
+        {
+            folded.append(data.data(), data.size());
+        };
+        return detail::fold_constants(os, escape(os), folded, fmt, constants.get_ptr());
     }
 }
 
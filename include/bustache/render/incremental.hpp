@@ -0,0 +1,101 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef BUSTACHE_RENDER_INCREMENTAL_HPP_INCLUDED
+#define BUSTACHE_RENDER_INCREMENTAL_HPP_INCLUDED
+
+#include <span>
+#include <string>
+#include <vector>
+#include <string_view>
+#include <bustache/render/string.hpp>
+
+namespace bustache
+{
+    // A change made by incremental_render::update: `size` bytes at `offset`
+    // of the output before it are replaced with `text`.
+    struct output_patch
+    {
+        std::size_t offset;
+        std::size_t size;
+        std::string text;
+    };
+
+    // Renders a format into a string, remembering where the output of each
+    // node at the top level of the format is and which names it looked up,
+    // so that the output can be brought up to date after some values of the
+    // data changed by rendering only the nodes that looked up their names,
+    // or the names of their parents or members (e.g. "a" or "a.b.c" for a
+    // change to "a.b"). A name relative to the data itself (i.e. `{{.}}` at
+    // the top level) is changed by any change. The output of a lambda or of
+    // a partial is taken to depend on the names looked up within it only.
+    // Only the top-level nodes are tracked, so a change to a name looked
+    // up within a section renders the whole section again, e.g. all of the
+    // output of a format wrapped in a single section. If a render throws,
+    // the output stays as before. The format must outlive it.
+    class incremental_render
+    {
+    public:
+        explicit incremental_render(format const& fmt) noexcept : _fmt(&fmt) {}
+
+        // Render all of it.
+        template<class Escape = no_escape_t>
+        std::string const& render
+        (
+            value_ref data, context_handler context = no_context_t{},
+            Escape escape = {}, unresolved_handler f = nullptr
+        )
+        {
+            detail::string_sink<std::string> const os{_buffer};
+            run(os, escape(os), data.get_ptr(), context, f, nullptr, nullptr);
+            return _output;
+        }
+
+        // Render the nodes which the values of `changed` may change, given
+        // the same escape as before, and return the changes to the output,
+        // in order. If it's not rendered yet, it's all changed.
+        template<class Escape = no_escape_t>
+        std::vector<output_patch> update
+        (
+            value_ref data, std::span<std::string_view const> changed,
+            context_handler context = no_context_t{}, Escape escape = {},
+            unresolved_handler f = nullptr
+        )
+        {
+            std::vector<output_patch> ret;
+            detail::string_sink<std::string> const os{_buffer};
+            run(os, escape(os), data.get_ptr(), context, f, &changed, &ret);
+            return ret;
+        }
+
+        std::string const& output() const noexcept { return _output; }
+
+    private:
+        struct region
+        {
+            std::size_t offset = 0;
+            std::size_t size = 0;
+            // Sorted.
+            std::vector<std::string> names;
+        };
+
+        BUSTACHE_API void run
+        (
+            output_handler raw_os, output_handler escape_os, value_ptr data,
+            context_handler context, unresolved_handler f,
+            std::span<std::string_view const> const* changed, std::vector<output_patch>* patches
+        );
+
+        format const* _fmt;
+        std::string _output;
+        // The output of the node being rendered.
+        std::string _buffer;
+        // One for each node at the top level.
+        std::vector<region> _regions;
+    };
+}
+
+#endif
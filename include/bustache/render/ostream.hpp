@@ -32,17 +32,18 @@ namespace bustache
     (
         std::basic_ostream<CharT, Traits>& out, format const& fmt,
         value_ref data, context_handler context = no_context_t{},
-        Escape escape = {}, unresolved_handler f = nullptr
+        Escape escape = {}, unresolved_handler f = nullptr,
+        render_engine engine = render_engine::tree
     )
     {
-        render(detail::ostream_sink<CharT, Traits>{out}, fmt, data, context, escape, f);
+        render(detail::ostream_sink<CharT, Traits>{out}, fmt, data, context, escape, f, engine);
     }
     
     template<class CharT, class Traits, class... Opts>
     inline std::basic_ostream<CharT, Traits>&
     operator<<(std::basic_ostream<CharT, Traits>& out, manipulator<Opts...> const& manip)
     {
-        render_ostream(out, manip.fmt, manip.data, get_context(manip), get_escape(manip));
+        render(detail::ostream_sink<CharT, Traits>{out}, manip);
         return out;
     }
 }
@@ -32,17 +32,24 @@ namespace bustache
     (
         String& out, format const& fmt,
         value_ref data, context_handler context = no_context_t{},
-        Escape escape = {}, unresolved_handler f = nullptr
+        Escape escape = {}, unresolved_handler f = nullptr,
+        render_engine engine = render_engine::tree
     )
     {
-        render(detail::string_sink<String>{out}, fmt, data, context, escape, f);
+        render(detail::string_sink<String>{out}, fmt, data, context, escape, f, engine);
+    }
+
+    template<class String, class... Opts>
+    inline void render_string(String& out, manipulator<Opts...> const& manip)
+    {
+        render(detail::string_sink<String>{out}, manip);
     }
     
     template<class... Opts>
     inline std::string to_string(manipulator<Opts...> const& manip)
     {
         std::string ret;
-        render_string(ret, manip.fmt, manip.data, get_context(manip), get_escape(manip));
+        render_string(ret, manip);
         return ret;
     }
 }
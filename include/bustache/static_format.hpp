@@ -0,0 +1,492 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef BUSTACHE_STATIC_FORMAT_HPP_INCLUDED
+#define BUSTACHE_STATIC_FORMAT_HPP_INCLUDED
+
+#include <array>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <string_view>
+#include <bustache/format.hpp>
+#include <bustache/detail/parse_core.hpp>
+
+// A constexpr counterpart of the parser in src/format.cpp, it must produce
+// the same document for the same source. The tags are read by the shared
+// parse_core; only the whole-input (`final`) mode is needed here, and the
+// byte scanning is done with plain loops.
+namespace bustache::static_parser
+{
+    using detail::parse_core::I;
+    using detail::parse_core::delim;
+    using detail::parse_core::is_space;
+    using detail::parse_core::parse_lit;
+    using detail::parse_core::process_pure;
+    using detail::parse_core::skip_blank_line;
+    using detail::parse_core::tag_kind;
+    using detail::parse_core::tag;
+    using detail::parse_core::plain_scan;
+
+    using lexer = detail::parse_core::lexer<plain_scan>;
+
+    // Unlike ast::content_list, usable in constant evaluation.
+    using content_list = std::vector<ast::content>;
+
+    struct overrider
+    {
+        std::string key;
+        content_list contents;
+    };
+
+    struct frame
+    {
+        ast::type kind{};
+        unsigned split = 0;
+        std::string key;
+        std::string indent;
+        content_list contents;
+        // Kept in order, the first one of a key wins like in override_map.
+        std::vector<overrider> overriders;
+
+        constexpr std::string_view name() const noexcept
+        {
+            return std::string_view(key.data(), split ? split : key.size());
+        }
+
+        constexpr bool is_inheritance() const noexcept
+        {
+            return kind == ast::type::partial;
+        }
+    };
+
+    // A text, as a range of the source.
+    struct text_ref
+    {
+        std::uint32_t offset;
+        std::uint32_t size;
+    };
+
+    // An entry of the override_map at context::overriders[group].
+    struct override_ref
+    {
+        std::uint32_t group;
+        ast::key_id key;
+        ast::list_ref contents;
+    };
+
+    // Like ast::context, with the parts that can't be constexpr flattened.
+    struct context
+    {
+        std::vector<text_ref> texts;
+        std::vector<ast::variable> variables;
+        std::vector<ast::block> blocks;
+        std::vector<ast::partial> partials;
+        std::vector<override_ref> overriders;
+        std::uint32_t groups = 0;
+        std::vector<ast::content> lists;
+        std::vector<ast::key_id> paths;
+        std::string key_chars;
+        std::vector<std::uint32_t> key_ends;
+        content_list contents;
+
+        constexpr std::string_view key(ast::key_id id) const noexcept
+        {
+            auto const begin = id ? key_ends[id - 1] + 1 : 0u;
+            return std::string_view(key_chars.data() + begin, key_ends[id] - begin);
+        }
+
+        constexpr ast::list_ref add_list(content_list const& contents_)
+        {
+            ast::list_ref ret{std::uint32_t(lists.size()), std::uint32_t(contents_.size())};
+            lists.insert(lists.end(), contents_.begin(), contents_.end());
+            return ret;
+        }
+    };
+
+    struct parser
+    {
+        context& ctx;
+        I b;
+        delim d{"{{", "}}"};
+        bool pure = true;
+        std::vector<frame> stack;
+
+        constexpr parser(context& ctx_param, I b_param) : ctx(ctx_param), b(b_param)
+        {
+            stack.emplace_back();
+        }
+
+        constexpr void parse(I i, I e)
+        {
+            for (I i0 = i; step(i0, i, e);)
+                ;
+            while (stack.size() > 1)
+                close_section();
+            ctx.contents = std::move(stack.back().contents);
+            stack.clear();
+        }
+
+        // Return false at the end of the input.
+        constexpr bool step(I& i0, I& i, I e)
+        {
+            I i1 = i;
+            while (i != e)
+            {
+                if (!pure && (i = plain_scan::find_either(i, e, d.open.front(), '\n')) == e)
+                    break;
+                if (*i == '\n')
+                {
+                    pure = true;
+                    i1 = ++i;
+                }
+                else if (is_space(*i))
+                    ++i;
+                else
+                {
+                    I const i2 = i;
+                    if (parse_lit(i, e, d.open))
+                    {
+                        auto t = lexer::read_tag(b, i, e, d, stack.back().name());
+                        return apply_tag(t, i0, i1, i2, i, e);
+                    }
+                    pure = false;
+                    ++i;
+                }
+            }
+            add_text(i0, i);
+            return false;
+        }
+
+        constexpr bool apply_tag(tag& t, I& i0, I i1, I i2, I& i, I e)
+        {
+            auto& top = stack.back();
+            switch (t.what)
+            {
+            case tag_kind::variable:
+                pure = false;
+                add_text(i0, i2);
+                if (!top.is_inheritance())
+                {
+                    std::string_view const key(t.key);
+                    auto const path = add_path(t.split ? key.substr(0, t.split) : key);
+                    add_content(t.kind, ctx.variables, ast::variable{intern(key), t.split, path});
+                }
+                i0 = i;
+                return true;
+            case tag_kind::block:
+            case tag_kind::inheritance:
+            {
+                auto const [start, standalone] = process_pure(i, e, pure);
+                add_text(i0, standalone ? i1 : i2);
+                frame f{};
+                if (t.what == tag_kind::block)
+                {
+                    f.kind = t.kind;
+                    f.split = t.split;
+                }
+                else
+                {
+                    f.kind = ast::type::partial;
+                    if (standalone)
+                        f.indent.assign(i1, static_cast<std::size_t>(i2 - i1));
+                }
+                f.key = std::move(t.key);
+                stack.push_back(std::move(f));
+                i0 = start;
+                return true;
+            }
+            default:
+                break;
+            }
+            I const i3 = i;
+            bool const standalone = pure && skip_blank_line(i, e);
+            pure = standalone;
+            add_text(i0, standalone ? i1 : i2);
+            switch (t.what)
+            {
+            case tag_kind::end_section:
+                if (!standalone)
+                    i = i3;
+                i0 = i;
+                if (stack.size() == 1)
+                    return false;
+                close_section();
+                return true;
+            case tag_kind::set_delim:
+                d = t.new_delim;
+                break;
+            case tag_kind::partial:
+                if (!top.is_inheritance())
+                {
+                    auto const indent = standalone ? intern_indent(std::string_view(i1, static_cast<std::size_t>(i2 - i1))) : ast::npos;
+                    add_content(ast::type::partial, ctx.partials, ast::partial{intern(t.key), indent, ast::npos});
+                }
+                break;
+            default:
+                break;
+            }
+            i0 = standalone ? i : i3;
+            return true;
+        }
+
+        template<class T>
+        constexpr void add_content(ast::type kind, std::vector<T>& nodes, T node)
+        {
+            stack.back().contents.push_back(ast::content{kind, unsigned(nodes.size())});
+            nodes.push_back(node);
+        }
+
+        constexpr void add_text(I i0, I i1)
+        {
+            if (i0 != i1 && !stack.back().is_inheritance())
+                add_content(ast::type::text, ctx.texts, text_ref{std::uint32_t(i0 - b), std::uint32_t(i1 - i0)});
+        }
+
+        constexpr void close_section()
+        {
+            auto f = std::move(stack.back());
+            stack.pop_back();
+            auto& parent = stack.back();
+            if (parent.is_inheritance())
+            {
+                if (f.kind == ast::type::inheritance)
+                {
+                    for (auto const& o : parent.overriders)
+                    {
+                        if (o.key == f.key)
+                            return;
+                    }
+                    parent.overriders.push_back({std::move(f.key), std::move(f.contents)});
+                }
+                return;
+            }
+            if (f.is_inheritance())
+            {
+                auto overriders = ast::npos;
+                if (!f.overriders.empty())
+                {
+                    overriders = ctx.groups++;
+                    for (auto const& o : f.overriders)
+                        ctx.overriders.push_back({overriders, intern(o.key), ctx.add_list(o.contents)});
+                }
+                auto const key = intern(f.key);
+                add_content(ast::type::partial, ctx.partials, ast::partial{key, intern_indent(f.indent), overriders});
+                return;
+            }
+            auto const key = f.split ? std::string_view(f.key).substr(f.split + 1) : std::string_view(f.key);
+            auto const path = f.kind == ast::type::inheritance ? ast::path_ref{} : add_path(key);
+            auto const id = intern(key);
+            add_content(f.kind, ctx.blocks, ast::block{id, ctx.add_list(f.contents), path});
+        }
+
+        constexpr ast::key_id intern(std::string_view key)
+        {
+            for (ast::key_id id = 0; id != ctx.key_ends.size(); ++id)
+            {
+                if (ctx.key(id) == key)
+                    return id;
+            }
+            ctx.key_chars.append(key);
+            ctx.key_ends.push_back(std::uint32_t(ctx.key_chars.size()));
+            ctx.key_chars.push_back('\0');
+            return ast::key_id(ctx.key_ends.size() - 1);
+        }
+
+        constexpr ast::key_id intern_indent(std::string_view indent)
+        {
+            return indent.empty() ? ast::npos : intern(indent);
+        }
+
+        constexpr ast::path_ref add_path(std::string_view name)
+        {
+            auto& paths = ctx.paths;
+            ast::path_ref ret{std::uint32_t(paths.size()), 0};
+            if (name.starts_with('.'))
+            {
+                paths.push_back(intern({}));
+                name.remove_prefix(1);
+            }
+            if (!name.empty())
+            {
+                for (;;)
+                {
+                    auto const n = name.find('.');
+                    paths.push_back(intern(name.substr(0, n)));
+                    if (n == name.npos)
+                        break;
+                    name.remove_prefix(n + 1);
+                }
+            }
+            ret.size = std::uint32_t(paths.size()) - ret.offset;
+            return ret;
+        }
+    };
+
+    constexpr context parse(std::string_view source)
+    {
+        context ctx;
+        parser(ctx, source.data()).parse(source.data(), source.data() + source.size());
+        return ctx;
+    }
+
+    // The sizes of the arrays in `document`.
+    struct extents
+    {
+        std::size_t texts, variables, blocks, partials, overriders, groups, lists, paths, key_chars, keys, contents;
+    };
+
+    constexpr extents measure(std::string_view source)
+    {
+        auto const ctx = parse(source);
+        return
+        {
+            ctx.texts.size(), ctx.variables.size(), ctx.blocks.size(), ctx.partials.size(),
+            ctx.overriders.size(), ctx.groups, ctx.lists.size(), ctx.paths.size(),
+            ctx.key_chars.size(), ctx.key_ends.size(), ctx.contents.size()
+        };
+    }
+
+    template<class T, std::size_t N>
+    constexpr void copy(std::array<T, N>& to, std::vector<T> const& from)
+    {
+        for (std::size_t i = 0; i != N; ++i)
+            to[i] = from[i];
+    }
+
+    // A parsed document in constant storage, its texts refer to the source.
+    template<extents X>
+    struct document
+    {
+        std::array<text_ref, X.texts> texts;
+        std::array<ast::variable, X.variables> variables;
+        std::array<ast::block, X.blocks> blocks;
+        std::array<ast::partial, X.partials> partials;
+        std::array<override_ref, X.overriders> overriders;
+        std::array<ast::content, X.lists> lists;
+        std::array<ast::key_id, X.paths> paths;
+        std::array<char, X.key_chars> key_chars;
+        std::array<std::uint32_t, X.keys> key_ends;
+        std::array<ast::content, X.contents> contents;
+
+        // Build the runtime document, which only copies the arrays.
+        ast::document get(std::string_view source) const
+        {
+            ast::document doc;
+            auto& ctx = doc.ctx;
+            ctx.texts.reserve(X.texts);
+            for (auto const t : texts)
+                ctx.texts.emplace_back(source.data() + t.offset, t.size);
+            ctx.variables.assign(variables.begin(), variables.end());
+            ctx.blocks.assign(blocks.begin(), blocks.end());
+            ctx.partials.assign(partials.begin(), partials.end());
+            ctx.lists.assign(lists.begin(), lists.end());
+            ctx.paths.assign(paths.begin(), paths.end());
+            ctx.key_chars.assign(key_chars.data(), key_chars.size());
+            ctx.key_ends.assign(key_ends.begin(), key_ends.end());
+            ctx.overriders.resize(X.groups);
+            for (auto const& o : overriders)
+            {
+                // The keys are interned, the first one of a key wins.
+                auto& map = ctx.overriders[o.group];
+                if (std::none_of(map.begin(), map.end(), [&](ast::overrider const& e) { return e.key == o.key; }))
+                    map.push_back({o.key, o.contents});
+            }
+            for (auto& map : ctx.overriders)
+            {
+                std::sort(map.begin(), map.end(), [&](ast::overrider const& a, ast::overrider const& b)
+                {
+                    return ctx.key(a.key) < ctx.key(b.key);
+                });
+            }
+            doc.contents.assign(contents.begin(), contents.end());
+            return doc;
+        }
+    };
+
+    template<extents X>
+    constexpr document<X> compile(std::string_view source)
+    {
+        auto const ctx = parse(source);
+        document<X> ret{};
+        copy(ret.texts, ctx.texts);
+        copy(ret.variables, ctx.variables);
+        copy(ret.blocks, ctx.blocks);
+        copy(ret.partials, ctx.partials);
+        copy(ret.overriders, ctx.overriders);
+        copy(ret.lists, ctx.lists);
+        copy(ret.paths, ctx.paths);
+        for (std::size_t i = 0; i != X.key_chars; ++i)
+            ret.key_chars[i] = ctx.key_chars[i];
+        copy(ret.key_ends, ctx.key_ends);
+        copy(ret.contents, ctx.contents);
+        return ret;
+    }
+}
+
+namespace bustache
+{
+    // A string literal usable as a template argument.
+    template<std::size_t N>
+    struct fixed_string
+    {
+        char data[N];
+
+        constexpr fixed_string(char const (&str)[N]) noexcept
+        {
+            for (std::size_t i = 0; i != N; ++i)
+                data[i] = str[i];
+        }
+
+        constexpr std::string_view view() const noexcept
+        {
+            return std::string_view(data, N - 1);
+        }
+    };
+
+    // A format whose source is parsed at compile time, an ill-formed source
+    // is a compile error. At runtime, the nodes are only copied out of the
+    // constant storage and the texts refer to the source in place.
+    template<fixed_string Source>
+    struct static_format
+    {
+        static constexpr auto document = static_parser::compile<static_parser::measure(Source.view())>(Source.view());
+
+        static constexpr std::string_view source() noexcept
+        {
+            return Source.view();
+        }
+
+        // The format, built on first use.
+        static format const& get()
+        {
+            static format const fmt(document.get(source()), false);
+            return fmt;
+        }
+
+        operator format const&() const
+        {
+            return get();
+        }
+
+        template<class T>
+        manipulator<detail::manip_core<T>> operator()(T const& data) const
+        {
+            return {get(), data};
+        }
+    };
+
+    inline namespace literals
+    {
+        template<fixed_string Source>
+        constexpr static_format<Source> operator""_sfmt() noexcept
+        {
+            return {};
+        }
+    }
+}
+
+#endif
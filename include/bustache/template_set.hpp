@@ -0,0 +1,97 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef BUSTACHE_TEMPLATE_SET_HPP_INCLUDED
+#define BUSTACHE_TEMPLATE_SET_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <functional>
+#include <filesystem>
+#include <string_view>
+#include <unordered_map>
+#include <bustache/format.hpp>
+
+namespace bustache
+{
+    // Thrown by template_set::load when some files are ill-formed, after all
+    // of them have been parsed.
+    class template_set_error : public std::runtime_error
+    {
+    public:
+        struct failure
+        {
+            std::filesystem::path file;
+            error_type code;
+            std::ptrdiff_t position;
+        };
+
+        BUSTACHE_API explicit template_set_error(std::vector<failure> failures);
+
+        std::vector<failure> const& failures() const noexcept { return _failures; }
+
+    private:
+        std::vector<failure> _failures;
+    };
+
+    // An immutable set of formats keyed by name, which can serve as the
+    // context for partials.
+    class template_set
+    {
+    public:
+        using map_type = std::unordered_map<std::string, format, ast::key_hash, std::equal_to<>>;
+
+        template_set() = default;
+        template_set(template_set&&) = default;
+        template_set& operator=(template_set&&) = default;
+        // Not copyable, since the formats may be linked to each other.
+        template_set(template_set const&) = delete;
+        template_set& operator=(template_set const&) = delete;
+
+        // Parse every regular file under `root` whose name ends with
+        // `extension`, using `threads` threads (0 for one per core). A file
+        // is named by its path relative to `root` without the extension,
+        // with '/' as the separator, e.g. "partials/header". The formats own
+        // their text.
+        BUSTACHE_API static template_set load
+        (
+            std::filesystem::path const& root, std::string_view extension = ".mustache",
+            unsigned threads = 0
+        );
+
+        // Link every format to the others in the set, see bustache::link.
+        BUSTACHE_API void link();
+
+        format const* find(std::string_view name) const
+        {
+            auto const it = _map.find(name);
+            return it == _map.end() ? nullptr : &it->second;
+        }
+
+        std::optional<std::reference_wrapper<format const>> operator()(std::string_view name) const
+        {
+            if (auto const p = find(name))
+                return std::cref(*p);
+            return std::nullopt;
+        }
+
+        map_type const& formats() const noexcept
+        {
+            return _map;
+        }
+
+        std::size_t size() const noexcept
+        {
+            return _map.size();
+        }
+
+    private:
+        map_type _map;
+    };
+}
+
+#endif
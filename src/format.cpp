@@ -8,555 +8,538 @@
 #include <utility>
 #include <cstring>
 #include <exception>
+#include <algorithm>
+#include <functional>
+#include <tuple>
+#include <unordered_set>
 #include <bustache/format.hpp>
+#include <bustache/detail/parse_core.hpp>
+#include "parse_kernels.hpp"
 
 namespace bustache::parser { namespace
 {
-    using I = char const*;
-
-    struct delim
+    using detail::parse_core::delim;
+    using detail::parse_core::parse_lit;
+    using detail::parse_core::process_pure;
+    using detail::parse_core::skip_blank_line;
+    using detail::parse_core::tag_kind;
+    using detail::parse_core::tag;
+
+    // Scans with the kernels selected for the CPU, see set_parser_kernel.
+    struct kernel_scan
     {
-        std::string_view open;
-        std::string_view close;
-    };
-
-    constexpr bool is_space(char c)
-    {
-        switch (c)
-        {
-        case ' ':
-        case '\f':
-        case '\n':
-        case '\r':
-        case '\t':
-        case '\v':
-            return true;
+        static I skip_space(I i, I e) noexcept
+        {
+            return kernels().skip_space(i, e);
         }
-        return false;
-    }
 
-#ifdef BUSTACHE_USE_SWAR // Performance tuning, disabled by default.
-    // Use tricks described here:
-    // http://0x80.pl/notesen/2023-03-06-swar-find-any.html
-    // The performance is yet to be explored.
+        static I find_either(I i, I e, char a, char b) noexcept
+        {
+            return kernels().find_either(i, e, a, b);
+        }
 
-    template<class T>
-    consteval T constv(T value)
-    {
-        return value;
-    }
+        static I find_key_stop(I i, I e, char a, char b) noexcept
+        {
+            return kernels().find_key_stop(i, e, a, b);
+        }
+    };
 
-    constexpr std::uint64_t broadcast(std::uint8_t byte)
-    {
-        return UINT64_C(0x101010101010101) * byte;
-    }
+    using lexer = detail::parse_core::lexer<kernel_scan>;
 
-    template<std::uint8_t... c>
-    std::uint64_t clear_ascii(std::uint64_t word)
+    // An open section, or the document itself at the bottom of the stack.
+    struct frame
     {
-        constexpr auto msb_mask = UINT64_C(0x8080808080808080);
-        constexpr auto mask = ~msb_mask;
-        const auto ascii = word & mask;
-        const auto match = (... & ((ascii ^ constv(broadcast(c))) + mask)) | word;
-        return match & msb_mask;
-    }
+        ast::type kind;
+        unsigned split; // Length of the section alias, if any.
+        std::string key;
+        std::string indent;
+        ast::content_list contents;
+        ast::override_map overriders;
+
+        // The name the end section tag must match.
+        std::string_view name() const noexcept
+        {
+            return std::string_view(key.data(), split ? split : key.size());
+        }
 
-    template<std::endian = std::endian::native>
-    constexpr unsigned zero_prefix(std::uint64_t mask);
+        // Only `{{$block}}`s are kept inside `{{<parent}}`.
+        bool is_inheritance() const noexcept
+        {
+            return kind == ast::type::partial;
+        }
+    };
 
-    template<>
-    constexpr unsigned zero_prefix<std::endian::little>(std::uint64_t mask)
+    // Lets the parser find a key already in the pool by its characters.
+    struct pooled_key_hash
     {
-        return std::countr_zero(mask) >> 3u;
-    }
+        using is_transparent = void;
 
-    template<>
-    constexpr unsigned zero_prefix<std::endian::big>(std::uint64_t mask)
-    {
-        return std::countl_zero(mask) >> 3u;
-    }
+        ast::context const* ctx;
 
-    unsigned space_prefix(std::uint64_t word)
-    {
-        const auto mask = clear_ascii<' ', '\f', '\n', '\r', '\t', '\v'>(word);
-        return zero_prefix(mask);
-    }
+        std::size_t operator()(std::string_view key) const noexcept
+        {
+            return ast::key_hash{}(key);
+        }
 
-#if 0 // This version of 'is_space' is slower.
-    constexpr std::uint64_t has_zero_byte(std::uint64_t v)
-    {
-        return (v - UINT64_C(0x101010101010101)) & ~v &
-            UINT64_C(0x8080808080808080);
-    }
+        std::size_t operator()(ast::key_id id) const noexcept
+        {
+            return ast::key_hash{}(ctx->key(id));
+        }
+    };
 
-    template<unsigned N>
-    constexpr std::uint64_t chars_mask(const std::uint8_t(&c)[N])
+    struct pooled_key_equal
     {
-        static_assert(N <= 8);
-        std::uint64_t mask = 0;
-        for (unsigned i = 0; i != N; ++i)
-            mask |= std::uint64_t(c[i]) << (8u * i);
-        return mask;
-    }
+        using is_transparent = void;
 
-    constexpr bool is_space(char c)
-    {
-        const auto mask = broadcast(c);
-        constexpr auto chars = chars_mask({' ', '\f', '\n', '\r', '\t', '\v'});
-        return has_zero_byte(mask ^ chars);
-    }
-#endif
+        ast::context const* ctx;
 
-    // Return true if it ends.
-    bool skip(I& i, I e) noexcept
-    {
-        auto n = e - i;
-        std::uint64_t word = 0;
-        for (; n >= 8; i += 8, n -= 8) {
-            std::memcpy(&word, i, 8);
-            const auto len = space_prefix(word);
-            if (len != 8) {
-                i += len;
-                return false;
-            }
+        std::string_view get(std::string_view key) const noexcept
+        {
+            return key;
         }
-        std::memcpy(&word, i, n);
-        i += space_prefix(word);
-        return i == e;
-    }
-#else
 
-    // Return true if it ends.
-    inline bool skip(I& i, I e) noexcept
-    {
-        while (i != e)
+        std::string_view get(ast::key_id id) const noexcept
         {
-            if (!is_space(*i))
-                return false;
-            ++i;
+            return ctx->key(id);
         }
-        return true;
-    }
-#endif
 
-    inline bool parse_sentinel(I& i, I e, char c) noexcept
-    {
-        if (i != e && *i == c)
+        template<class A, class B>
+        bool operator()(A const& a, B const& b) const noexcept
         {
-            skip(++i, e);
-            return true;
+            return get(a) == get(b);
         }
-        return false;
-    }
+    };
 
-    inline bool parse_lit(I& i, I e, std::string_view str) noexcept
+    enum class status
     {
-        if (e - i < std::ptrdiff_t(str.size()))
-            return false;
-        I p = i;
-        for (char c : str)
-        {
-            if (*p != c)
-                return false;
-            ++p;
-        }
-        i = p;
-        return true;
-    }
+        more,   // A tag was consumed, call again.
+        end,    // The input is exhausted.
+        starved // Can't proceed without seeing more input.
+    };
 
-    void parse_dyn_sigil(I& i, I e, std::string& key)
+    // The parser is a loop over an explicit stack of open sections, so the
+    // nesting depth of the template doesn't cost any native stack.
+    //
+    // It can also be fed incrementally: with `final` unset, [i, e) is only a
+    // prefix of the input and a step is not applied while its outcome may
+    // still depend on what comes after `e`.
+    struct parser
     {
-        skip(i, e);
-        if (i != e && *i == '*')
+        ast::context& ctx;
+        I b;
+        delim d{"{{", "}}"};
+        bool pure = true;
+        std::vector<frame> stack;
+        // The keys this parser has added to the pool.
+        std::unordered_set<ast::key_id, pooled_key_hash, pooled_key_equal> keys;
+
+        parser(ast::context& ctx_param, I b_param)
+          : ctx(ctx_param), b(b_param), keys(0, pooled_key_hash{&ctx_param}, pooled_key_equal{&ctx_param})
         {
-            key = '*';
-            ++i;
+            stack.emplace_back();
         }
-    }
 
-    unsigned expect_key(I b, I& i, I e, delim& d, std::string& key, char sentinel)
-    {
-        unsigned split = 0;
-        skip(i, e);
-        for (I const i0 = i; i != e; ++i)
-        {
-            I const i1 = i;
-            if (is_space(*i)) [[unlikely]]
-                skip(++i, e);
-            if (!sentinel || parse_sentinel(i, e, sentinel))
-            {
-                if (parse_lit(i, e, d.close))
-                {
-                    if (split ? split + 1 == i1 - i0 : i0 == i1) [[unlikely]]
-                        break;
-                    key.append(i0, i1);
-                    return split;
-                }
-            }
-            if (i == e) [[unlikely]]
-                break;
-            if (!split && *i == ':')
-            {
-                split = unsigned(i - i0);
-                if (!split) [[unlikely]]
-                    break;
-            }
+        void parse(I i, I e, ast::content_list& attr)
+        {
+            for (I i0 = i; step(i0, i, e, true) == status::more;)
+                ;
+            finish(attr);
         }
-        throw format_error(error_badkey, i - b);
-    }
-
-    struct pure_result
-    {
-        I start;
-        bool standalone;
-    };
 
-    pure_result process_pure(I& i, I e, bool pure) noexcept
-    {
-        pure_result ret{i, pure};
-        if (pure)
+        void finish(ast::content_list& attr)
         {
-            while (i != e)
-            {
-                if (*i == '\n')
-                {
-                    ret.start = ++i;
-                    break;
-                }
-                else if (is_space(*i))
-                    ++i;
-                else
-                {
-                    ret.standalone = false;
-                    break;
-                }
-            }
+            while (stack.size() > 1)
+                close_section();
+            attr = std::move(stack.back().contents);
+            stack.clear();
         }
-        return ret;
-    }
 
-    struct tag_result
-    {
-        bool is_end_section;
-        bool check_standalone;
-        bool is_standalone;
-    };
+        // Parse the text up to and including the next tag.
+        status step(I& i0, I& i, I e, bool final);
 
-    struct parser
-    {
-        ast::context& ctx;
+        bool try_read_tag(tag& t, I& i, I e);
+
+        status apply_tag(tag& t, I& i0, I i1, I i2, I& i, I e, bool final);
 
-        void parse_start(I& i, I e, ast::content_list& attr)
+        void add_text(I i0, I i1)
         {
-            delim d{"{{", "}}"};
-            bool pure = true;
-            parse_contents(i, i, i, e, d, pure, attr, {});
+            if (i0 != i1 && !stack.back().is_inheritance())
+                stack.back().contents.push_back(ctx.add(std::string_view(i0, static_cast<std::size_t>(i1 - i0))));
         }
 
-        bool parse_content
-        (
-            I b, I& i0, I& i, I e, delim& d, bool& pure,
-            std::string_view& text, ast::content& attr,
-            std::string_view section
-        );
+        void close_section();
 
-        void parse_contents
-        (
-            I b, I i0, I& i, I e, delim& d, bool& pure,
-            ast::content_list& attr, std::string_view section
-        );
+        ast::key_id intern(std::string_view key)
+        {
+            if (auto const it = keys.find(key); it != keys.end())
+                return *it;
+            auto const id = ctx.add_key(key);
+            keys.insert(id);
+            return id;
+        }
 
-        bool expect_block(I b, I& i, I e, delim& d, bool& pure, ast::block& attr)
+        ast::key_id intern_indent(std::string_view indent)
         {
-            std::string key;
-            auto const split = expect_key(b, i, e, d, key, '\0');
-            auto const [i0, standalone] = process_pure(i, e, pure);
-            std::string_view section;
-            if (split)
+            return indent.empty() ? ast::npos : intern(indent);
+        }
+
+        // Split `name` at dots, so it's not scanned again when rendered.
+        ast::path_ref add_path(std::string_view name)
+        {
+            auto& paths = ctx.paths;
+            ast::path_ref ret{std::uint32_t(paths.size()), 0};
+            if (name.starts_with('.'))
             {
-                attr.key = key.substr(split + 1);
-                section = std::string_view(key.data(), split);
+                paths.push_back(intern({}));
+                name.remove_prefix(1);
             }
-            else
+            if (!name.empty())
             {
-                attr.key = std::move(key);
-                section = attr.key;
+                for (;;)
+                {
+                    auto const n = name.find('.');
+                    paths.push_back(intern(name.substr(0, n)));
+                    if (n == name.npos)
+                        break;
+                    name.remove_prefix(n + 1);
+                }
             }
-            parse_contents(b, i0, i, e, d, pure, attr.contents, section);
-            return standalone;
+            ret.size = std::uint32_t(paths.size()) - ret.offset;
+            return ret;
         }
-
-        bool expect_inheritance(I b, I& i, I e, delim& d, bool& pure, ast::partial& attr);
-
-        tag_result expect_tag
-        (
-            I b, I& i, I e, delim& d, bool& pure,
-            ast::content& attr, std::string_view section
-        );
     };
 
-    bool parser::expect_inheritance(I b, I& i, I e, delim& d, bool& pure, ast::partial& attr)
+    status parser::step(I& i0, I& i, I e, bool final)
     {
-        expect_key(b, i, e, d, attr.key, '\0');
-        auto [i0, standalone] = process_pure(i, e, pure);
-        for (std::string_view text;;)
+        auto const& k = kernels();
+        I const start = i;
+        bool const pure0 = pure;
+        I i1 = i;
+        // Where the line became impure, if it did in this step.
+        I dirty = start;
+        // The text before `safe` is plain whatever comes next, and the line
+        // is pure up to there if `safe_pure` is set.
+        I safe = i1;
+        bool safe_pure = true;
+        while (i != e)
         {
-            ast::content a;
-            auto const end = parse_content(b, i0, i, e, d, pure, text, a, attr.key);
-            if (a.kind == ast::type::inheritance)
+            // Once the line is impure, only a newline or the start of an
+            // open delimiter can change anything, so jump straight there.
+            if (!pure && (i = k.find_either(i, e, d.open.front(), '\n')) == e)
+                break;
+            if (*i == '\n')
             {
-                auto& block = ctx.blocks[a.index];
-                attr.overriders.emplace(std::move(block.key), std::move(block.contents));
+                pure = true;
+                i1 = ++i;
             }
-            if (end)
-                break;
-        }
-        return standalone;
-    }
-
-    void expect_comment(I b, I& i, I e, delim& d)
-    {
-        while (i != e)
-        {
-            if (parse_lit(i, e, d.close))
-                return;
-            if (parse_lit(i, e, d.open))
+            else if (is_space(*i))
+                ++i;
+            else
             {
-                while (!parse_lit(i, e, d.close))
+                I const i2 = i;
+                if (parse_lit(i, e, d.open))
                 {
-                    if (i == e)
-                        throw format_error(error_delim, i - b);
-                    ++i;
+                    // Only a tag on a pure line may be standalone.
+                    safe = pure ? i1 : i2;
+                    safe_pure = pure;
+                    tag t;
+                    if (final)
+                        t = lexer::read_tag(b, i, e, d, stack.back().name());
+                    else if (!try_read_tag(t, i, e))
+                        goto starved;
+                    if (auto const s = apply_tag(t, i0, i1, i2, i, e, final); s != status::starved)
+                        return s;
+                    goto starved;
                 }
-            }
-            else
+                if (pure)
+                    dirty = i;
+                pure = false;
                 ++i;
+            }
         }
-        throw format_error(error_delim, i - b);
+        if (final)
+        {
+            add_text(i0, i);
+            return status::end;
+        }
+        safe = i1;
+        // On an impure line, only what may be the start of an open delimiter
+        // has to wait, so a long line isn't scanned again on every step.
+        if (!pure)
+        {
+            if (I const lim = e - std::ptrdiff_t(d.open.size() - 1); dirty < lim)
+            {
+                safe = lim;
+                safe_pure = false;
+            }
+        }
+    starved:
+        if (safe != start)
+        {
+            add_text(i0, safe);
+            i0 = i = safe;
+            pure = safe_pure;
+        }
+        else
+        {
+            i = start;
+            pure = pure0;
+        }
+        return status::starved;
     }
 
-    void expect_set_delim(I b, I& i, I e, delim& d)
+    bool parser::try_read_tag(tag& t, I& i, I e)
     {
-        skip(i, e);
-        I i0 = i;
-        for (;;)
+        auto const section = stack.back().name();
+        try
         {
-            if (i == e)
-                throw format_error(error_baddelim, i - b);
-            if (is_space(*i))
-                break;
-            ++i;
+            t = lexer::read_tag(b, i, e, d, section);
+            return true;
         }
-        d.open = std::string_view(i0, static_cast<std::size_t>(i - i0));
-        skip(i, e);
-        i0 = i;
-        I i1 = i;
-        for (;; ++i)
+        catch (format_error const& err)
         {
-            if (i == e)
-                throw format_error(error_set_delim, i - b);
-            if (*i == '=')
-            {
-                i1 = i;
-                break;
-            }
-            if (is_space(*i))
-            {
-                i1 = i;
-                if (skip(++i, e) || *i != '=')
-                    throw format_error(error_set_delim, i - b);
-                break;
-            }
+            // Every decision the tag reader makes at a position looks at
+            // most one literal ahead, so an error reported further than that
+            // from `e` can't be fixed by more input.
+            auto const lookahead = std::max({d.open.size(), d.close.size(), section.size()});
+            if (e - (b + err.position()) > std::ptrdiff_t(lookahead))
+                throw;
+            return false;
         }
-        if (i0 == i1)
-            throw format_error(error_baddelim, i - b);
-        skip(++i, e);
-        if (!parse_lit(i, e, d.close))
-            throw format_error(error_delim, i - b);
-        d.close = std::string_view(i0, static_cast<std::size_t>(i1 - i0));
     }
 
-    tag_result parser::expect_tag
-    (
-        I b, I& i, I e, delim& d, bool& pure,
-        ast::content& attr, std::string_view section
-    )
+    status parser::apply_tag(tag& t, I& i0, I i1, I i2, I& i, I e, bool final)
     {
-        if (skip(i, e))
-            throw format_error(error_badkey, i - b);
-        tag_result ret{};
-        ast::type kind;
-        switch (*i)
+        auto& top = stack.back();
+        switch (t.what)
         {
-        case '#':
-            kind = ast::type::section;
+        case tag_kind::variable:
+            pure = false;
+            add_text(i0, i2);
+            if (!top.is_inheritance())
             {
-            block:
-                ast::block a;
-                ret.is_standalone = expect_block(b, ++i, e, d, pure, a);
-                attr = ctx.add(kind, std::move(a));
+                std::string_view const key(t.key);
+                auto const path = add_path(t.split ? key.substr(0, t.split) : key);
+                top.contents.push_back(ctx.add(t.kind, ast::variable{intern(key), t.split, path}));
             }
-            break;
-        case '^':
-            kind = ast::type::inversion;
-            goto block;
-        case '?':
-            kind = ast::type::filter;
-            goto block;
-        case '*':
-            kind = ast::type::loop;
-            goto block;
-        case '$':
-            kind = ast::type::inheritance;
-            goto block;
-        case '/':
-            skip(++i, e);
-            if (!parse_lit(i, e, section))
-                throw format_error(error_section, i - b);
-            skip(i, e);
-            if (!parse_lit(i, e, d.close))
-                throw format_error(error_delim, i - b);
-            ret.check_standalone = pure;
-            ret.is_end_section = true;
-            break;
-        case '!':
+            i0 = i;
+            return status::more;
+        case tag_kind::block:
+        case tag_kind::inheritance:
         {
-            expect_comment(b, ++i, e, d);
-            ret.check_standalone = pure;
-            break;
+            auto const [start, standalone] = process_pure(i, e, pure);
+            if (!final && i == e)
+                return status::starved;
+            add_text(i0, standalone ? i1 : i2);
+            frame f{};
+            if (t.what == tag_kind::block)
+            {
+                f.kind = t.kind;
+                f.split = t.split;
+            }
+            else
+            {
+                f.kind = ast::type::partial;
+                if (standalone)
+                    f.indent.assign(i1, static_cast<std::size_t>(i2 - i1));
+            }
+            f.key = std::move(t.key);
+            stack.push_back(std::move(f));
+            i0 = start;
+            return status::more;
         }
-        case '=':
-        {
-            expect_set_delim(b, ++i, e, d);
-            ret.check_standalone = pure;
+        default:
             break;
         }
-        case '>':
+        // The rest are standalone candidates.
+        I const i3 = i;
+        bool const standalone = pure && skip_blank_line(i, e);
+        if (!final && i == e)
+            return status::starved;
+        pure = standalone;
+        add_text(i0, standalone ? i1 : i2);
+        switch (t.what)
         {
-            ast::partial a;
-            parse_dyn_sigil(++i, e, a.key);
-            expect_key(b, i, e, d, a.key, '\0');
-            attr = ctx.add(std::move(a));
-            ret.check_standalone = pure;
+        case tag_kind::end_section:
+            if (!standalone)
+                i = i3;
+            i0 = i;
+            if (stack.size() == 1) // Unmatched end section at top level.
+                return status::end;
+            close_section();
+            return status::more;
+        case tag_kind::set_delim:
+            d = t.new_delim;
             break;
-        }
-        case '&':
-        case '{':
-        {
-            ast::variable a;
-            char const sentinel = *i == '{' ? '}' : '\0';
-            a.split = expect_key(b, ++i, e, d, a.key, sentinel);
-            attr = ctx.add(ast::type::var_raw, std::move(a));
-            pure = false;
+        case tag_kind::partial:
+            if (!top.is_inheritance())
+            {
+                auto const indent = standalone ? intern_indent(std::string_view(i1, static_cast<std::size_t>(i2 - i1))) : ast::npos;
+                top.contents.push_back(ctx.add(ast::partial{intern(t.key), indent, ast::npos}));
+            }
             break;
-        }
-        // Extensions
-        case '<':
-        {
-            ast::partial a;
-            parse_dyn_sigil(++i, e, a.key);
-            ret.is_standalone = expect_inheritance(b, i, e, d, pure, a);
-            attr = ctx.add(std::move(a));
-            return ret;
-        }
         default:
-            ast::variable a;
-            a.split = expect_key(b, i, e, d, a.key, '\0');
-            attr = ctx.add(ast::type::var_escaped, std::move(a));
-            pure = false;
             break;
         }
-        return ret;
+        i0 = standalone ? i : i3;
+        return status::more;
     }
 
-    // Return true if it ends.
-    bool parser::parse_content
-    (
-        I b, I& i0, I& i, I e, delim& d, bool& pure,
-        std::string_view& text, ast::content& attr,
-        std::string_view section
-    )
+    void parser::close_section()
     {
-        for (I i1 = i; i != e;)
+        auto f = std::move(stack.back());
+        stack.pop_back();
+        auto& parent = stack.back();
+        if (parent.is_inheritance())
         {
-            if (*i == '\n')
+            if (f.kind == ast::type::inheritance)
             {
-                pure = true;
-                i1 = ++i;
+                // The first one of a name wins.
+                auto const key = intern(f.key);
+                auto const& overriders = parent.overriders;
+                if (std::none_of(overriders.begin(), overriders.end(), [key](ast::overrider const& o) { return o.key == key; }))
+                    parent.overriders.push_back({key, ctx.add_list(f.contents)});
             }
-            else if (is_space(*i))
-                ++i;
-            else
+            return;
+        }
+        if (f.is_inheritance())
+        {
+            auto overriders = ast::npos;
+            if (!f.overriders.empty())
             {
-                I const i2 = i;
-                if (parse_lit(i, e, d.open))
+                std::sort(f.overriders.begin(), f.overriders.end(), [this](ast::overrider const& lhs, ast::overrider const& rhs)
                 {
-                    tag_result tag(expect_tag(b, i, e, d, pure, attr, section));
-                    text = std::string_view(i0, static_cast<std::size_t>(i1 - i0));
-                    if (tag.check_standalone)
-                    {
-                        I const i3 = i;
-                        while (i != e)
-                        {
-                            if (*i == '\n')
-                            {
-                                ++i;
-                                break;
-                            }
-                            else if (is_space(*i))
-                                ++i;
-                            else
-                            {
-                                pure = false;
-                                text = std::string_view(i0, static_cast<std::size_t>(i2 - i0));
-                                // For end-section, we move the current pos (i)
-                                // since i0 is local to the section and is not
-                                // propagated upwards.
-                                (tag.is_end_section ? i : i0) = i3;
-                                return tag.is_end_section;
-                            }
-                        }
-                        tag.is_standalone = true;
-                    }
-                    if (!tag.is_standalone)
-                        text = std::string_view(i0, static_cast<std::size_t>(i2 - i0));
-                    else if (attr.kind == ast::type::partial)
-                    {
-                        auto& partial = ctx.partials[attr.index];
-                        partial.indent.assign(i1, static_cast<std::size_t>(i2 - i1));
-                    }
-                    i0 = i;
-                    return i == e || tag.is_end_section;
-                }
-                else
+                    return ctx.key(lhs.key) < ctx.key(rhs.key);
+                });
+                overriders = std::uint32_t(ctx.overriders.size());
+                ctx.overriders.push_back(std::move(f.overriders));
+            }
+            parent.contents.push_back(ctx.add(ast::partial{intern(f.key), intern_indent(f.indent), overriders}));
+            return;
+        }
+        auto const key = f.split ? std::string_view(f.key).substr(f.split + 1) : std::string_view(f.key);
+        auto const path = f.kind == ast::type::inheritance ? ast::path_ref{} : add_path(key);
+        parent.contents.push_back(ctx.add(f.kind, ast::block{intern(key), ctx.add_list(f.contents), path}));
+    }
+}}
+
+namespace bustache::detail
+{
+    // What an `editable` format remembers of its parse: the state of the
+    // parser before each step taken at the top level. Parsing can resume from
+    // any of them, and a new parse in the same state at the same (shifted)
+    // position will produce the same contents from there on.
+    struct source_map
+    {
+        struct step
+        {
+            std::size_t i0;
+            std::size_t i;
+            std::size_t count; // Top-level contents before the step.
+            unsigned delim;    // Index into `delims`.
+            bool pure;
+        };
+
+        std::string source;
+        std::vector<step> steps;
+        std::vector<std::pair<std::string, std::string>> delims;
+        // Nodes in the context no longer reachable from the document.
+        std::size_t garbage = 0;
+    };
+}
+
+namespace bustache::detail { namespace
+{
+    std::unique_ptr<char[], text_deleter> allocate_text(std::pmr::memory_resource* resource, std::size_t n)
+    {
+        return {static_cast<char*>(resource->allocate(n, 1)), {resource, n}};
+    }
+}}
+
+namespace bustache::parser { namespace
+{
+    using detail::source_map;
+
+    // Parse `map.source` from the state `from`, recording the state before
+    // each top-level step into `map`. Return true if stopped by `resync`,
+    // which is asked about every state before it's recorded.
+    template<class Resync>
+    bool parse_recorded(parser& p, source_map& map, source_map::step const& from, Resync resync)
+    {
+        I const b = map.source.data();
+        I const e = b + map.source.size();
+        I i0 = b + from.i0;
+        I i = b + from.i;
+        auto delim = from.delim;
+        p.b = b;
+        p.d = {map.delims[delim].first, map.delims[delim].second};
+        p.pure = from.pure;
+        for (;;)
+        {
+            if (p.stack.size() == 1)
+            {
+                auto const& [open, close] = map.delims[delim];
+                if (p.d.open != open || p.d.close != close)
                 {
-                    pure = false;
-                    ++i;
+                    // `p.d` refers to the source now, not to `delims`.
+                    delim = unsigned(map.delims.size());
+                    map.delims.emplace_back(p.d.open, p.d.close);
                 }
+                source_map::step const s
+                {
+                    static_cast<std::size_t>(i0 - b), static_cast<std::size_t>(i - b),
+                    from.count + p.stack.front().contents.size(), delim, p.pure
+                };
+                if (resync(s))
+                    return true;
+                map.steps.push_back(s);
             }
+            if (p.step(i0, i, e, true) != status::more)
+                return false;
         }
-        text = std::string_view(i0, static_cast<std::size_t>(i - i0));
-        return true;
     }
 
-    void parser::parse_contents
-    (
-        I b, I i0, I& i, I e, delim& d, bool& pure,
-        ast::content_list& attr, std::string_view section
-    )
+    // The number of nodes reachable from [i, e).
+    std::size_t count_nodes(ast::context const& ctx, ast::content const* i, ast::content const* e)
     {
-        for (;;)
+        std::size_t n = 0;
+        std::vector<std::pair<ast::content const*, ast::content const*>> todo{{i, e}};
+        while (!todo.empty())
         {
-            std::string_view text;
-            ast::content a;
-            auto end = parse_content(b, i0, i, e, d, pure, text, a, section);
-            if (!text.empty())
-                attr.push_back(ctx.add(text));
-            if (!a.is_null())
-                attr.push_back(a);
-            if (end)
-                return;
+            std::tie(i, e) = todo.back();
+            todo.pop_back();
+            n += static_cast<std::size_t>(e - i);
+            for (; i != e; ++i)
+            {
+                switch (i->kind)
+                {
+                case ast::type::section:
+                case ast::type::inversion:
+                case ast::type::filter:
+                case ast::type::loop:
+                case ast::type::inheritance:
+                case ast::type::cache:
+                {
+                    auto const contents = ctx.list(ctx.blocks[i->index].contents);
+                    todo.emplace_back(contents.data(), contents.data() + contents.size());
+                    break;
+                }
+                case ast::type::partial:
+                    if (auto const overriders = ctx.partials[i->index].overriders; overriders != ast::npos)
+                    {
+                        for (auto const& o : ctx.overriders[overriders])
+                        {
+                            auto const contents = ctx.list(o.contents);
+                            todo.emplace_back(contents.data(), contents.data() + contents.size());
+                        }
+                    }
+                    break;
+                default:
+                    break;
+                }
+            }
         }
+        return n;
     }
 }}
 
@@ -588,7 +571,143 @@ namespace bustache
 
     void format::init(char const* begin, char const* end)
     {
-        parser::parser{_doc.ctx}.parse_start(begin, end, _doc.contents);
+        parser::parser(_doc.ctx, begin).parse(begin, end, _doc.contents);
+    }
+
+    void format::init_editable(std::string_view source)
+    {
+        auto map = std::make_shared<detail::source_map>();
+        map->source = source;
+        map->delims.emplace_back("{{", "}}");
+        parser::parser p(_doc.ctx, nullptr);
+        parser::parse_recorded(p, *map, {0, 0, 0, 0, true}, [](auto const&) { return false; });
+        p.finish(_doc.contents);
+        _source = std::move(map);
+    }
+
+    void format::edit(source_edit const& e)
+    {
+        if (!_source)
+            throw std::logic_error("bustache::format::edit: not an editable format");
+        auto const& old = *_source;
+        if (e.offset > old.source.size() || e.length > old.source.size() - e.offset)
+            throw std::out_of_range("bustache::format::edit: edit out of range");
+
+        auto map = std::make_shared<detail::source_map>();
+        auto& source = map->source;
+        source.reserve(old.source.size() - e.length + e.text.size());
+        source.append(old.source, 0, e.offset).append(e.text).append(old.source, e.offset + e.length);
+        map->delims = old.delims;
+
+        // Resume from the last top-level step that didn't read the edit.
+        auto const& steps = old.steps;
+        using step = detail::source_map::step;
+        auto const k = static_cast<std::size_t>(std::partition_point(steps.begin() + 1, steps.end(),
+            [&](step const& s) { return s.i < e.offset; }) - steps.begin()) - 1;
+        map->steps.assign(steps.begin(), steps.begin() + std::ptrdiff_t(k));
+
+        // Stop as soon as the parse is past the edit and in sync with the old
+        // one, i.e. at step `m`.
+        auto const edit_end = e.offset + e.text.size();
+        auto const shift = [&](std::size_t pos) { return pos + e.text.size() - e.length; };
+        auto const unshift = [&](std::size_t pos) { return pos + e.length - e.text.size(); };
+        auto m = steps.size();
+        auto const resync = [&](step const& s)
+        {
+            if (s.i0 < edit_end)
+                return false;
+            auto const i = unshift(s.i);
+            auto const it = std::partition_point(steps.begin() + std::ptrdiff_t(k) + 1, steps.end(),
+                [i](step const& old_s) { return old_s.i < i; });
+            if (it == steps.end() || it->i != i || it->i0 != unshift(s.i0) || it->pure != s.pure
+                || map->delims[s.delim] != old.delims[it->delim])
+                return false;
+            m = static_cast<std::size_t>(it - steps.begin());
+            return true;
+        };
+
+        auto& ctx = _doc.ctx;
+        auto const texts = ctx.texts.size();
+        auto const newlines = ctx.newlines.size();
+        auto const variables = ctx.variables.size();
+        auto const blocks = ctx.blocks.size();
+        auto const partials = ctx.partials.size();
+        auto const overriders = ctx.overriders.size();
+        auto const lists = ctx.lists.size();
+        auto const paths = ctx.paths.size();
+        auto const key_chars = ctx.key_chars.size();
+        auto const keys = ctx.key_ends.size();
+        ast::content_list fresh;
+        try
+        {
+            parser::parser p(ctx, nullptr);
+            if (parser::parse_recorded(p, *map, steps[k], resync))
+                fresh = std::move(p.stack.front().contents);
+            else
+                p.finish(fresh);
+
+            auto const first = steps[k].count;
+            auto const last = m == steps.size() ? _doc.contents.size() : steps[m].count;
+            auto const& contents = _doc.contents;
+            map->garbage = old.garbage + parser::count_nodes(ctx, contents.data() + first, contents.data() + last);
+            // Start over once the dead nodes outnumber the live ones.
+            if (map->garbage * 2 > ctx.texts.size() + ctx.variables.size() + ctx.blocks.size() + ctx.partials.size())
+            {
+                *this = format(map->source, editable);
+                return;
+            }
+            fresh.reserve(first + fresh.size() + contents.size() - last);
+            fresh.insert(fresh.begin(), contents.begin(), contents.begin() + std::ptrdiff_t(first));
+            fresh.insert(fresh.end(), contents.begin() + std::ptrdiff_t(last), contents.end());
+            for (auto i = m; i != steps.size(); ++i)
+            {
+                auto s = steps[i];
+                s.i0 = shift(s.i0);
+                s.i = shift(s.i);
+                s.count += fresh.size() - contents.size();
+                map->steps.push_back(s);
+            }
+        }
+        catch (...)
+        {
+            ctx.texts.erase(ctx.texts.begin() + std::ptrdiff_t(texts), ctx.texts.end());
+            ctx.text_newlines.resize(texts);
+            ctx.newlines.resize(newlines);
+            ctx.variables.erase(ctx.variables.begin() + std::ptrdiff_t(variables), ctx.variables.end());
+            ctx.blocks.erase(ctx.blocks.begin() + std::ptrdiff_t(blocks), ctx.blocks.end());
+            ctx.partials.erase(ctx.partials.begin() + std::ptrdiff_t(partials), ctx.partials.end());
+            ctx.overriders.erase(ctx.overriders.begin() + std::ptrdiff_t(overriders), ctx.overriders.end());
+            ctx.lists.resize(lists);
+            ctx.paths.resize(paths);
+            ctx.key_chars.resize(key_chars);
+            ctx.key_ends.resize(keys);
+            throw;
+        }
+
+        // Move the old texts to the new source, those overlapping the edited
+        // range are no longer reachable.
+        auto const b = old.source.data();
+        for (std::size_t i = 0; i != texts; ++i)
+        {
+            auto& text = ctx.texts[i];
+            if (text.empty())
+                continue;
+            auto const pos = static_cast<std::size_t>(text.data() - b);
+            if (pos + text.size() <= e.offset)
+                text = {source.data() + pos, text.size()};
+            else if (pos >= e.offset + e.length)
+                text = {source.data() + shift(pos), text.size()};
+            else
+                text = {};
+        }
+        _doc.contents = std::move(fresh);
+        _source = std::move(map);
+        _program.reset();
+    }
+
+    std::string_view format::source() const noexcept
+    {
+        return _source ? std::string_view(_source->source) : std::string_view();
     }
 
     std::size_t format::text_size() const noexcept
@@ -603,8 +722,8 @@ namespace bustache
     {
         if (n)
         {
-            auto data = new char[n];
-            _text.reset(data);
+            _text = detail::allocate_text(resource(), n);
+            auto data = _text.get();
             for (auto& text : _doc.ctx.texts)
             {
                 auto text_size = text.size();
@@ -614,4 +733,151 @@ namespace bustache
             }
         }
     }
-}
\ No newline at end of file
+}
+namespace bustache
+{
+    struct format_builder::impl
+    {
+        ast::document doc;
+        parser::parser p{doc.ctx, nullptr};
+        // Input not consumed yet, starting at `consumed` in the whole input.
+        std::string pending;
+        std::ptrdiff_t consumed = 0;
+        // Offsets of the parser's i0 and i into `pending`.
+        std::size_t i0 = 0;
+        std::size_t i = 0;
+        // Texts [0, kept) have been moved into `store`.
+        std::size_t kept = 0;
+        std::unique_ptr<char[], detail::text_deleter> store;
+        std::size_t store_size = 0;
+        std::size_t store_capacity = 0;
+        std::string open;
+        std::string close;
+        bool done = false;
+
+        void run(bool final);
+        void keep_texts();
+        void keep_delim();
+        bool in_pending(std::string_view s) const noexcept;
+    };
+
+    bool format_builder::impl::in_pending(std::string_view s) const noexcept
+    {
+        std::less<char const*> const less;
+        auto const b = pending.data();
+        return !less(s.data(), b) && less(s.data(), b + pending.size());
+    }
+
+    void format_builder::impl::run(bool final)
+    {
+        if (done)
+            return;
+        auto const b = pending.data();
+        auto const e = b + pending.size();
+        parser::I pi0 = b + i0;
+        parser::I pi = b + i;
+        p.b = b;
+        parser::status s;
+        try
+        {
+            do s = p.step(pi0, pi, e, final); while (s == parser::status::more);
+        }
+        catch (format_error const& err)
+        {
+            throw format_error(err.code(), err.position() + consumed);
+        }
+        i0 = static_cast<std::size_t>(pi0 - b);
+        i = static_cast<std::size_t>(pi - b);
+        keep_texts();
+        keep_delim();
+        if (s == parser::status::end)
+        {
+            done = true;
+            i0 = i = pending.size();
+        }
+        // Drop the consumed input once it's at least half of the buffer, so
+        // the cost of moving the tail is amortized.
+        if (i0 >= pending.size() - i0)
+        {
+            pending.erase(0, i0);
+            consumed += std::ptrdiff_t(i0);
+            i -= i0;
+            i0 = 0;
+        }
+    }
+
+    void format_builder::impl::keep_texts()
+    {
+        auto& texts = doc.ctx.texts;
+        std::size_t n = store_size;
+        for (auto j = kept; j != texts.size(); ++j)
+            n += texts[j].size();
+        if (n > store_capacity)
+        {
+            auto const capacity = std::max(n, store_capacity * 2);
+            auto data = detail::allocate_text(std::pmr::get_default_resource(), capacity);
+            if (store_size)
+                std::memcpy(data.get(), store.get(), store_size);
+            for (std::size_t j = 0; j != kept; ++j)
+            {
+                auto& text = texts[j];
+                text = {data.get() + (text.data() - store.get()), text.size()};
+            }
+            store = std::move(data);
+            store_capacity = capacity;
+        }
+        for (; kept != texts.size(); ++kept)
+        {
+            auto& text = texts[kept];
+            auto const data = store.get() + store_size;
+            std::memcpy(data, text.data(), text.size());
+            text = {data, text.size()};
+            store_size += text.size();
+        }
+    }
+
+    void format_builder::impl::keep_delim()
+    {
+        auto& d = p.d;
+        if (in_pending(d.open) || in_pending(d.close))
+        {
+            std::string o(d.open), c(d.close);
+            open.swap(o);
+            close.swap(c);
+            d = {open, close};
+        }
+    }
+
+    format_builder::format_builder() : _impl(new impl) {}
+
+    format_builder::format_builder(format_builder&& other) noexcept = default;
+
+    format_builder& format_builder::operator=(format_builder&& other) noexcept = default;
+
+    format_builder::~format_builder() = default;
+
+    void format_builder::feed(std::string_view chunk)
+    {
+        if (!_impl)
+            _impl.reset(new impl);
+        auto& m = *_impl;
+        if (m.done || chunk.empty())
+            return;
+        m.pending.append(chunk);
+        m.run(false);
+    }
+
+    format format_builder::finish()
+    {
+        if (!_impl)
+            _impl.reset(new impl);
+        auto& m = *_impl;
+        m.run(true);
+        m.p.finish(m.doc.contents);
+        format ret;
+        ret._doc = std::move(m.doc);
+        ret._text = std::move(m.store);
+        _impl.reset(new impl);
+        return ret;
+    }
+}
@@ -0,0 +1,79 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <bustache/fragment_cache.hpp>
+
+namespace bustache
+{
+    lru_fragment_cache::lru_fragment_cache(std::size_t capacity) : _capacity(capacity) {}
+
+    bool lru_fragment_cache::load(std::uint64_t id, std::string_view key, output_handler os)
+    {
+        std::shared_ptr<std::string const> output;
+        {
+            std::lock_guard const lock(_mutex);
+            auto const it = _map.find({id, key});
+            if (it != _map.end())
+            {
+                _entries.splice(_entries.begin(), _entries, it->second);
+                output = it->second->output;
+            }
+        }
+        if (!output)
+        {
+            _misses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        _hits.fetch_add(1, std::memory_order_relaxed);
+        os(*output);
+        return true;
+    }
+
+    void lru_fragment_cache::store(std::uint64_t id, std::string_view key, std::string_view output)
+    {
+        auto const n = key.size() + output.size();
+        if (n > _capacity)
+            return;
+        auto value = std::make_shared<std::string const>(output);
+        std::lock_guard const lock(_mutex);
+        if (auto const it = _map.find({id, key}); it != _map.end())
+        {
+            // Rendered by another one meanwhile.
+            auto& e = *it->second;
+            _size -= e.output->size();
+            _size += value->size();
+            e.output = std::move(value);
+            _entries.splice(_entries.begin(), _entries, it->second);
+        }
+        else
+        {
+            _entries.push_front({id, std::string(key), std::move(value)});
+            _map.emplace(entry_key{id, _entries.front().key}, _entries.begin());
+            _size += n;
+        }
+        while (_size > _capacity)
+        {
+            auto const& e = _entries.back();
+            _size -= e.key.size() + e.output->size();
+            _map.erase({e.id, e.key});
+            _entries.pop_back();
+        }
+    }
+
+    void lru_fragment_cache::clear()
+    {
+        std::lock_guard const lock(_mutex);
+        _map.clear();
+        _entries.clear();
+        _size = 0;
+    }
+
+    std::size_t lru_fragment_cache::size() const
+    {
+        std::lock_guard const lock(_mutex);
+        return _size;
+    }
+}
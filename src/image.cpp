@@ -0,0 +1,377 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+#include <bustache/image.hpp>
+
+// The image is a header followed by the arrays of the AST, stored in the
+// native byte order and node layout, so loading is mostly memcpy. Bump
+// `version` whenever either changes.
+namespace bustache { namespace
+{
+    constexpr char magic[4] = {'B', 'S', 'T', 'I'};
+    constexpr std::uint32_t version = 2;
+    constexpr std::uint32_t byte_order = 0x01020304;
+
+    struct header
+    {
+        char magic[4];
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        std::uint32_t contents;
+        std::uint32_t texts;
+        std::uint32_t text_chars;
+        std::uint32_t variables;
+        std::uint32_t blocks;
+        std::uint32_t partials;
+        std::uint32_t overriders;
+        std::uint32_t lists;
+        std::uint32_t paths;
+        std::uint32_t keys;
+        std::uint32_t key_chars;
+    };
+
+    template<class T, std::size_t N>
+    constexpr bool is_plain = std::is_trivially_copyable_v<T> && sizeof(T) == N;
+
+    static_assert(is_plain<header, 56>);
+    static_assert(is_plain<ast::content, 8>);
+    static_assert(is_plain<ast::variable, 16>);
+    static_assert(is_plain<ast::block, 20>);
+    static_assert(is_plain<ast::partial, 12>);
+    static_assert(is_plain<ast::overrider, 12>);
+
+    struct text_entry
+    {
+        std::uint32_t offset;
+        std::uint32_t size;
+    };
+
+    [[noreturn]] void fail(char const* what)
+    {
+        throw image_error(std::string("bustache image: ") + what);
+    }
+
+    std::uint32_t checked_size(std::size_t n)
+    {
+        if (n > UINT32_MAX)
+            fail("too large");
+        return std::uint32_t(n);
+    }
+
+    struct writer
+    {
+        std::string& out;
+
+        void u32(std::uint32_t n)
+        {
+            out.append(reinterpret_cast<char const*>(&n), sizeof(n));
+        }
+
+        template<class T>
+        void array(T const* data, std::size_t n)
+        {
+            out.append(reinterpret_cast<char const*>(data), n * sizeof(T));
+        }
+    };
+
+    struct reader
+    {
+        char const* i;
+        char const* const e;
+
+        char const* take(std::size_t n)
+        {
+            if (std::size_t(e - i) < n)
+                fail("truncated");
+            auto const p = i;
+            i += n;
+            return p;
+        }
+
+        std::uint32_t u32()
+        {
+            std::uint32_t n;
+            std::memcpy(&n, take(sizeof(n)), sizeof(n));
+            return n;
+        }
+
+        template<class T, class A>
+        void array(std::vector<T, A>& v, std::size_t n)
+        {
+            auto const p = take(n * sizeof(T));
+            v.resize(n);
+            if (n)
+                std::memcpy(static_cast<void*>(v.data()), p, n * sizeof(T));
+        }
+    };
+
+    // A count followed by the elements.
+    template<class T, class A>
+    void write_list(writer& w, std::vector<T, A> const& list)
+    {
+        w.u32(checked_size(list.size()));
+        w.array(list.data(), list.size());
+    }
+
+    template<class T, class A>
+    void read_list(reader& r, std::vector<T, A>& list)
+    {
+        r.array(list, r.u32());
+    }
+
+    // Checks everything the renderer relies on, so that a corrupted image
+    // is rejected instead of rendered, but the texts, which are checked as
+    // they're read.
+    struct validator
+    {
+        ast::context const& ctx;
+
+        void check(bool ok) const
+        {
+            if (!ok)
+                fail("corrupted");
+        }
+
+        bool valid_key(ast::key_id id) const noexcept
+        {
+            return id < ctx.key_ends.size();
+        }
+
+        void check(ast::content c) const
+        {
+            switch (c.kind)
+            {
+            case ast::type::text:
+                return check(c.index < ctx.texts.size());
+            case ast::type::var_escaped:
+            case ast::type::var_raw:
+                return check(c.index < ctx.variables.size());
+            case ast::type::section:
+            case ast::type::inversion:
+            case ast::type::filter:
+            case ast::type::loop:
+            case ast::type::inheritance:
+            case ast::type::cache:
+                return check(c.index < ctx.blocks.size());
+            case ast::type::partial:
+                return check(c.index < ctx.partials.size());
+            default:
+                fail("corrupted");
+            }
+        }
+
+        void check(std::span<ast::content const> contents) const
+        {
+            for (auto const c : contents)
+                check(c);
+        }
+
+        template<class Ref, class T, class A>
+        void check(Ref ref, std::vector<T, A> const& pool) const
+        {
+            check(ref.offset <= pool.size() && ref.size <= pool.size() - ref.offset);
+        }
+
+        void run(ast::content_list const& root) const
+        {
+            std::uint32_t begin = 0;
+            for (auto const end : ctx.key_ends)
+            {
+                check(begin <= end && end < ctx.key_chars.size() && !ctx.key_chars[end]);
+                begin = end + 1;
+            }
+            for (auto const id : ctx.paths)
+                check(valid_key(id));
+            check(std::span<ast::content const>(ctx.lists));
+            for (auto const& map : ctx.overriders)
+            {
+                for (auto const& o : map)
+                {
+                    check(valid_key(o.key));
+                    check(o.contents, ctx.lists);
+                }
+                // Sorted and unique, see ast::override_map.
+                for (std::size_t i = 1; i < map.size(); ++i)
+                    check(ctx.key(map[i - 1].key) < ctx.key(map[i].key));
+            }
+            for (auto const& v : ctx.variables)
+            {
+                check(valid_key(v.key) && (!v.split || v.split < ctx.key(v.key).size()));
+                check(v.path, ctx.paths);
+            }
+            for (auto const& b : ctx.blocks)
+            {
+                check(valid_key(b.key));
+                check(b.contents, ctx.lists);
+                check(b.path, ctx.paths);
+            }
+            for (auto const& p : ctx.partials)
+            {
+                check(valid_key(p.key));
+                check(p.indent == ast::npos || valid_key(p.indent));
+                check(p.overriders == ast::npos || p.overriders < ctx.overriders.size());
+            }
+            check(std::span<ast::content const>(root));
+            check_acyclic();
+        }
+
+        // Blocks and partials are numbered together, partials last.
+        template<class F>
+        void for_each_child(std::size_t node, F const& f) const
+        {
+            auto const visit = [&](std::span<ast::content const> contents)
+            {
+                for (auto const c : contents)
+                {
+                    if (c.kind == ast::type::partial)
+                        f(ctx.blocks.size() + c.index);
+                    else if (c.kind >= ast::type::section)
+                        f(std::size_t(c.index));
+                }
+            };
+            if (node < ctx.blocks.size())
+                return visit(ctx.list(ctx.blocks[node].contents));
+            auto const& p = ctx.partials[node - ctx.blocks.size()];
+            if (p.overriders != ast::npos)
+            {
+                for (auto const& o : ctx.overriders[p.overriders])
+                    visit(ctx.list(o.contents));
+            }
+        }
+
+        // Without this a block could contain itself and the renderer
+        // wouldn't terminate.
+        void check_acyclic() const
+        {
+            auto const n = ctx.blocks.size() + ctx.partials.size();
+            std::vector<std::uint32_t> parents(n);
+            for (std::size_t i = 0; i != n; ++i)
+                for_each_child(i, [&](std::size_t child) { ++parents[child]; });
+            std::vector<std::size_t> ready;
+            for (std::size_t i = 0; i != n; ++i)
+            {
+                if (!parents[i])
+                    ready.push_back(i);
+            }
+            std::size_t done = 0;
+            while (!ready.empty())
+            {
+                auto const i = ready.back();
+                ready.pop_back();
+                ++done;
+                for_each_child(i, [&](std::size_t child)
+                {
+                    if (!--parents[child])
+                        ready.push_back(child);
+                });
+            }
+            check(done == n);
+        }
+    };
+}}
+
+namespace bustache
+{
+    std::string save_image(format const& fmt)
+    {
+        auto const& doc = fmt.doc();
+        auto const& ctx = doc.ctx;
+        std::size_t text_chars = 0;
+        for (auto const& text : ctx.texts)
+            text_chars += text.size();
+
+        header const h
+        {
+            {magic[0], magic[1], magic[2], magic[3]}, version, byte_order,
+            checked_size(doc.contents.size()),
+            checked_size(ctx.texts.size()),
+            checked_size(text_chars),
+            checked_size(ctx.variables.size()),
+            checked_size(ctx.blocks.size()),
+            checked_size(ctx.partials.size()),
+            checked_size(ctx.overriders.size()),
+            checked_size(ctx.lists.size()),
+            checked_size(ctx.paths.size()),
+            checked_size(ctx.key_ends.size()),
+            checked_size(ctx.key_chars.size())
+        };
+
+        std::string out;
+        writer w{out};
+        w.array(&h, 1);
+        w.array(doc.contents.data(), doc.contents.size());
+        std::uint32_t offset = 0;
+        for (auto const& text : ctx.texts)
+        {
+            text_entry const entry{offset, std::uint32_t(text.size())};
+            w.array(&entry, 1);
+            offset += entry.size;
+        }
+        for (auto const& text : ctx.texts)
+            out.append(text);
+        w.array(ctx.variables.data(), ctx.variables.size());
+        w.array(ctx.blocks.data(), ctx.blocks.size());
+        w.array(ctx.partials.data(), ctx.partials.size());
+        for (auto const& map : ctx.overriders)
+            write_list(w, map);
+        w.array(ctx.lists.data(), ctx.lists.size());
+        w.array(ctx.paths.data(), ctx.paths.size());
+        w.array(ctx.key_ends.data(), ctx.key_ends.size());
+        out.append(ctx.key_chars);
+        return out;
+    }
+
+    format load_image(std::string_view image, bool copytext, std::pmr::memory_resource* resource)
+    {
+        reader r{image.data(), image.data() + image.size()};
+        header h;
+        std::memcpy(&h, r.take(sizeof(h)), sizeof(h));
+        if (std::memcmp(h.magic, magic, sizeof(magic)))
+            fail("bad magic");
+        if (h.version != version)
+            fail("unsupported version");
+        if (h.byte_order != byte_order)
+            fail("byte order mismatch");
+
+        ast::document doc(resource);
+        auto& ctx = doc.ctx;
+        r.array(doc.contents, h.contents);
+        std::vector<text_entry> texts;
+        r.array(texts, h.texts);
+        auto const chars = r.take(h.text_chars);
+        // The newlines of the texts aren't stored, format(doc, copytext)
+        // indexes them below.
+        ctx.texts.reserve(texts.size());
+        for (auto const& entry : texts)
+        {
+            // An empty text isn't in a parsed document, and the renderer
+            // reads the last character of each.
+            if (!entry.size || entry.offset > h.text_chars || entry.size > h.text_chars - entry.offset)
+                fail("corrupted");
+            ctx.texts.emplace_back(chars + entry.offset, entry.size);
+        }
+        r.array(ctx.variables, h.variables);
+        r.array(ctx.blocks, h.blocks);
+        r.array(ctx.partials, h.partials);
+        // Each map takes at least 4 bytes.
+        if (h.overriders > std::size_t(r.e - r.i) / 4)
+            fail("truncated");
+        ctx.overriders.resize(h.overriders);
+        for (auto& map : ctx.overriders)
+            read_list(r, map);
+        r.array(ctx.lists, h.lists);
+        r.array(ctx.paths, h.paths);
+        r.array(ctx.key_ends, h.keys);
+        ctx.key_chars.assign(r.take(h.key_chars), h.key_chars);
+        if (r.i != r.e)
+            fail("trailing data");
+        validator{ctx}.run(doc.contents);
+        return format(std::move(doc), copytext);
+    }
+}
@@ -0,0 +1,546 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <unordered_map>
+#include <bustache/render.hpp>
+
+// The passes rewrite the document in place. A pass never changes a node that
+// may be shared, it adds a new one and leaves the old one to `compact`.
+namespace bustache::optimizer { namespace
+{
+    struct state
+    {
+        ast::document& doc;
+        // The texts made by the passes, until the format copies its text.
+        std::vector<std::string> texts;
+    };
+
+    struct pass
+    {
+        bool optimize_options::*enabled;
+        void(*run)(state& s);
+    };
+
+    bool is_section(ast::type kind) noexcept
+    {
+        switch (kind)
+        {
+        case ast::type::section:
+        case ast::type::inversion:
+        case ast::type::filter:
+        case ast::type::loop:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Call `f` on every content list of the document, reachable or not. A
+    // list may only shrink, its contents staying in order. Children come
+    // before their parents as far as the parser is concerned.
+    template<class F>
+    void for_each_list(ast::document& doc, F const& f)
+    {
+        auto& ctx = doc.ctx;
+        auto const shrink = [&](ast::list_ref& ref)
+        {
+            auto const first = ctx.lists.begin() + std::ptrdiff_t(ref.offset);
+            ref.size = std::uint32_t(f(first, first + std::ptrdiff_t(ref.size)) - first);
+        };
+        for (auto& block : ctx.blocks)
+            shrink(block.contents);
+        for (auto& map : ctx.overriders)
+        {
+            for (auto& o : map)
+                shrink(o.contents);
+        }
+        doc.contents.erase(f(doc.contents.begin(), doc.contents.end()), doc.contents.end());
+    }
+
+    void prune_empty(state& s)
+    {
+        auto const& blocks = s.doc.ctx.blocks;
+        for (bool changed = true; changed;)
+        {
+            changed = false;
+            for_each_list(s.doc, [&](auto first, auto last)
+            {
+                auto const end = std::remove_if(first, last, [&](ast::content c)
+                {
+                    return is_section(c.kind) && !blocks[c.index].contents.size;
+                });
+                changed |= end != last;
+                return end;
+            });
+        }
+    }
+
+    void coalesce_text(state& s)
+    {
+        auto& texts = s.doc.ctx.texts;
+        // Made texts are pointed to once all of them are in place.
+        std::vector<std::size_t> made;
+        for_each_list(s.doc, [&](auto first, auto last)
+        {
+            auto out = first;
+            while (first != last)
+            {
+                auto run = first;
+                while (run != last && run->kind == ast::type::text)
+                    ++run;
+                if (run - first > 1)
+                {
+                    std::string merged;
+                    for (auto i = first; i != run; ++i)
+                        merged += texts[i->index];
+                    *out++ = {ast::type::text, unsigned(texts.size())};
+                    made.push_back(s.texts.size());
+                    texts.emplace_back();
+                    s.texts.push_back(std::move(merged));
+                    first = run;
+                }
+                else
+                    *out++ = *first++;
+            }
+            return out;
+        });
+        auto i = texts.size() - made.size();
+        for (auto const n : made)
+            texts[i++] = s.texts[n];
+        s.doc.ctx.index_newlines();
+    }
+
+    // Rebuild the context with the reachable nodes only, in the order they
+    // are reached.
+    struct compactor
+    {
+        ast::context const& from;
+        ast::context to;
+        std::unordered_map<std::string_view, ast::key_id> keys;
+
+        // A list whose contents still refer to `from`.
+        struct pending
+        {
+            std::span<ast::content const> contents;
+            std::uint32_t offset;              // Into to.lists, unless...
+            ast::content_list* list = nullptr; // ...it's the document.
+        };
+        std::vector<pending> todo;
+
+        ast::key_id key(ast::key_id id)
+        {
+            if (id == ast::npos)
+                return id;
+            auto const k = from.key(id);
+            if (auto const it = keys.find(k); it != keys.end())
+                return it->second;
+            auto const ret = to.add_key(k);
+            keys.emplace(k, ret);
+            return ret;
+        }
+
+        ast::path_ref path(ast::path_ref ref)
+        {
+            ast::path_ref ret{std::uint32_t(to.paths.size()), ref.size};
+            for (auto const id : from.path(ref))
+                to.paths.push_back(key(id));
+            return ret;
+        }
+
+        ast::list_ref list(ast::list_ref ref)
+        {
+            ast::list_ref ret{std::uint32_t(to.lists.size()), ref.size};
+            to.lists.resize(to.lists.size() + ref.size);
+            todo.push_back({from.list(ref), ret.offset});
+            return ret;
+        }
+
+        ast::content node(ast::content c)
+        {
+            switch (c.kind)
+            {
+            case ast::type::text:
+                return to.add(from.texts[c.index]);
+            case ast::type::var_escaped:
+            case ast::type::var_raw:
+            {
+                auto const& v = from.variables[c.index];
+                return to.add(c.kind, ast::variable{key(v.key), v.split, path(v.path)});
+            }
+            case ast::type::section:
+            case ast::type::inversion:
+            case ast::type::filter:
+            case ast::type::loop:
+            case ast::type::inheritance:
+            case ast::type::cache:
+            {
+                auto const& b = from.blocks[c.index];
+                auto const k = key(b.key);
+                auto const p = path(b.path);
+                return to.add(c.kind, ast::block{k, list(b.contents), p});
+            }
+            case ast::type::partial:
+            {
+                auto const& p = from.partials[c.index];
+                auto overriders = ast::npos;
+                if (p.overriders != ast::npos)
+                {
+                    overriders = std::uint32_t(to.overriders.size());
+                    // The names are the same, so is the order.
+                    auto& map = to.overriders.emplace_back();
+                    for (auto const& o : from.overriders[p.overriders])
+                        map.push_back({key(o.key), list(o.contents)});
+                }
+                return to.add(ast::partial{key(p.key), key(p.indent), overriders});
+            }
+            default:
+                return c;
+            }
+        }
+
+        ast::content_list run(std::span<ast::content const> contents)
+        {
+            ast::content_list ret(contents.size(), to.get_allocator());
+            todo.push_back({contents, 0, &ret});
+            while (!todo.empty())
+            {
+                auto const p = todo.back();
+                todo.pop_back();
+                for (std::size_t i = 0; i != p.contents.size(); ++i)
+                {
+                    auto const c = node(p.contents[i]);
+                    // `to.lists` may have grown, don't hold on to it.
+                    (p.list ? p.list->data() : to.lists.data() + p.offset)[i] = c;
+                }
+            }
+            return ret;
+        }
+    };
+
+    void compact(state& s)
+    {
+        compactor c{s.doc.ctx, ast::context(s.doc.ctx.get_allocator()), {}, {}};
+        auto contents = c.run(s.doc.contents);
+        s.doc.ctx = std::move(c.to);
+        s.doc.contents = std::move(contents);
+    }
+
+    constexpr pass passes[] =
+    {
+        {&optimize_options::prune_empty, prune_empty},
+        {&optimize_options::coalesce_text, coalesce_text},
+        {&optimize_options::compact, compact}
+    };
+}}
+
+namespace bustache::optimizer { namespace
+{
+    // Whether the next text or variable starts a line, i.e. the renderer's
+    // `needs_indent`, as far as it's known without rendering.
+    enum class line
+    {
+        start,
+        middle,
+        unknown
+    };
+
+    line join(line a, line b) noexcept
+    {
+        return a == b ? a : line::unknown;
+    }
+
+    // An overrider in effect while the contents of its partial are copied.
+    struct override
+    {
+        ast::context const* ctx;
+        ast::key_id key;
+        ast::list_ref contents;
+    };
+
+    // Copies a document into a new context, replacing the partials that
+    // can be resolved once with their contents.
+    struct inliner
+    {
+        context_handler context;
+        // Whether the partials without overriders are replaced too.
+        bool plain;
+        ast::context to;
+        std::unordered_map<std::string_view, ast::key_id> keys;
+        // Texts with an indent applied, and the indents themselves.
+        std::deque<std::string> texts;
+        // The formats being copied, a partial of one of them is kept.
+        std::vector<format const*> active;
+        // Within overriders, which are rendered with the indent of where
+        // they're used.
+        bool keep = false;
+        // Those of the partials being replaced, outermost first.
+        std::vector<override> overrides;
+
+        override const* find_override(std::string_view name) const noexcept
+        {
+            for (auto const& o : overrides)
+            {
+                if (o.ctx->key(o.key) == name)
+                    return &o;
+            }
+            return nullptr;
+        }
+
+        ast::key_id key(ast::context const& from, ast::key_id id)
+        {
+            if (id == ast::npos)
+                return id;
+            auto const k = from.key(id);
+            if (auto const it = keys.find(k); it != keys.end())
+                return it->second;
+            auto const ret = to.add_key(k);
+            keys.emplace(k, ret);
+            return ret;
+        }
+
+        ast::path_ref path(ast::context const& from, ast::path_ref ref)
+        {
+            ast::path_ref ret{std::uint32_t(to.paths.size()), ref.size};
+            for (auto const id : from.path(ref))
+                to.paths.push_back(key(from, id));
+            return ret;
+        }
+
+        // Copy `contents` into `out` with `indent` applied as the renderer
+        // would. Return false if that depends on the data.
+        bool copy(ast::context const& from, std::span<ast::content const> contents, std::string_view indent, line& state, ast::content_list& out);
+
+        bool copy_partial(ast::context const& from, ast::partial const& p, std::string_view indent, line& state, ast::content_list& out);
+    };
+
+    bool inliner::copy(ast::context const& from, std::span<ast::content const> contents, std::string_view indent, line& state, ast::content_list& out)
+    {
+        for (auto const c : contents)
+        {
+            switch (c.kind)
+            {
+            case ast::type::text:
+            {
+                auto const text = from.texts[c.index];
+                if (indent.empty())
+                {
+                    out.push_back(to.add(text));
+                    break;
+                }
+                if (state == line::unknown)
+                    return false;
+                auto& s = texts.emplace_back();
+                if (state == line::start)
+                    s = indent;
+                std::size_t i0 = 0;
+                // The last newline is left to what comes next.
+                from.for_each_newline(c.index, [&](std::size_t pos)
+                {
+                    s.append(text, i0, pos + 1 - i0);
+                    s += indent;
+                    i0 = pos + 1;
+                });
+                s.append(text, i0);
+                state = text.ends_with('\n') ? line::start : line::middle;
+                out.push_back(to.add(ast::text(s)));
+                break;
+            }
+            case ast::type::var_escaped:
+            case ast::type::var_raw:
+            {
+                if (!indent.empty())
+                {
+                    if (state == line::unknown)
+                        return false;
+                    if (state == line::start)
+                        out.push_back(to.add(indent));
+                    state = line::middle;
+                }
+                auto const& v = from.variables[c.index];
+                out.push_back(to.add(c.kind, ast::variable{key(from, v.key), v.split, path(from, v.path)}));
+                break;
+            }
+            case ast::type::section:
+            case ast::type::inversion:
+            case ast::type::filter:
+            case ast::type::loop:
+            case ast::type::inheritance:
+            case ast::type::cache:
+            {
+                // An override may come from outside of the indented partial.
+                if (c.kind == ast::type::inheritance && !indent.empty())
+                    return false;
+                auto const& b = from.blocks[c.index];
+                // An overridden block keeps its name, an override from outside
+                // of the result still wins.
+                auto body_ctx = &from;
+                auto body = from.list(b.contents);
+                if (c.kind == ast::type::inheritance && !keep)
+                {
+                    if (auto const o = find_override(from.key(b.key)))
+                    {
+                        body_ctx = o->ctx;
+                        body = o->ctx->list(o->contents);
+                    }
+                }
+                ast::content_list list;
+                // The contents may be rendered any number of times.
+                auto exit = state;
+                if (!copy(*body_ctx, body, indent, exit, list))
+                    return false;
+                if (exit != state)
+                {
+                    exit = line::unknown;
+                    list.clear();
+                    if (!copy(*body_ctx, body, indent, exit, list))
+                        return false;
+                }
+                state = join(state, exit);
+                auto const k = key(from, b.key);
+                auto const p = path(from, b.path);
+                out.push_back(to.add(c.kind, ast::block{k, to.add_list(list), p}));
+                break;
+            }
+            case ast::type::partial:
+                if (!copy_partial(from, from.partials[c.index], indent, state, out))
+                    return false;
+                break;
+            default:
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool inliner::copy_partial(ast::context const& from, ast::partial const& p, std::string_view indent, line& state, ast::content_list& out)
+    {
+        auto const name = from.key(p.key);
+        format const* fmt = nullptr;
+        if (!keep && (plain || p.overriders != ast::npos) && !name.starts_with('*'))
+        {
+            if (auto const opt_format = context(name))
+                fmt = &opt_format->get();
+        }
+        if (fmt && std::find(active.begin(), active.end(), fmt) == active.end())
+        {
+            auto const& doc = fmt->doc();
+            if (doc.contents.empty())
+                return true;
+            auto inner = indent;
+            auto inner_state = state;
+            if (p.indent != ast::npos)
+            {
+                auto& s = texts.emplace_back(indent);
+                s += from.key(p.indent);
+                inner = s;
+                inner_state = line::start;
+            }
+            auto const old_overrides = overrides.size();
+            if (p.overriders != ast::npos)
+            {
+                for (auto const& o : from.overriders[p.overriders])
+                {
+                    if (!find_override(from.key(o.key)))
+                        overrides.push_back({&from, o.key, o.contents});
+                }
+            }
+            ast::content_list list;
+            active.push_back(fmt);
+            bool const ok = copy(doc.ctx, doc.contents, inner, inner_state, list);
+            active.pop_back();
+            overrides.resize(old_overrides);
+            if (ok)
+            {
+                out.insert(out.end(), list.begin(), list.end());
+                state = inner_state;
+                return true;
+            }
+        }
+        // Kept as is, it wouldn't see the indent.
+        if (!indent.empty())
+            return false;
+        // The overrides in effect are no longer there when it's rendered, so
+        // it takes them as its own overriders, before those it has. Within
+        // overriders, it's rendered where they're still there.
+        auto all = keep ? std::vector<override>() : overrides;
+        if (p.overriders != ast::npos)
+        {
+            for (auto const& o : from.overriders[p.overriders])
+            {
+                if (!find_override(from.key(o.key)))
+                    all.push_back({&from, o.key, o.contents});
+            }
+        }
+        auto overriders = ast::npos;
+        if (!all.empty())
+        {
+            ast::override_map map;
+            auto const was_keeping = std::exchange(keep, true);
+            for (auto const& o : all)
+            {
+                ast::content_list list;
+                auto s = line::unknown;
+                copy(*o.ctx, o.ctx->list(o.contents), {}, s, list);
+                map.push_back({key(*o.ctx, o.key), to.add_list(list)});
+            }
+            keep = was_keeping;
+            std::sort(map.begin(), map.end(), [this](ast::overrider const& a, ast::overrider const& b)
+            {
+                return to.key(a.key) < to.key(b.key);
+            });
+            overriders = std::uint32_t(to.overriders.size());
+            to.overriders.push_back(std::move(map));
+        }
+        out.push_back(to.add(ast::partial{key(from, p.key), key(from, p.indent), overriders}));
+        return true;
+    }
+}}
+
+namespace bustache
+{
+    static format flatten(format const& fmt, context_handler context, bool plain)
+    {
+        optimizer::inliner in{context, plain, {}, {}, {}, {&fmt}, false, {}};
+        ast::document doc;
+        auto state = optimizer::line::unknown;
+        in.copy(fmt.doc().ctx, fmt.doc().contents, {}, state, doc.contents);
+        doc.ctx = std::move(in.to);
+        // The texts refer to `in` and to the partials until copied here.
+        format ret(std::move(doc), false);
+        ret.optimize();
+        return ret;
+    }
+
+    format inline_partials(format const& fmt, context_handler context)
+    {
+        return flatten(fmt, context, true);
+    }
+
+    format resolve_inheritance(format const& fmt, context_handler context)
+    {
+        return flatten(fmt, context, false);
+    }
+
+    void format::optimize(optimize_options const& opts)
+    {
+        optimizer::state s{_doc, {}};
+        for (auto const& pass : optimizer::passes)
+        {
+            if (opts.*pass.enabled)
+                pass.run(s);
+        }
+        // The texts may refer to the old buffer or to `s`.
+        auto const old = std::move(_text);
+        copy_text(text_size());
+        _source.reset();
+        _program.reset();
+    }
+}
@@ -0,0 +1,376 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include "parse_kernels.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#   define BUSTACHE_KERNELS_X86
+#   include <immintrin.h>
+#   if defined(_MSC_VER) && !defined(__clang__)
+#       include <intrin.h>
+#   endif
+#endif
+
+#if defined(__GNUC__)
+#   define BUSTACHE_TARGET(arch) __attribute__((target(arch)))
+#else
+#   define BUSTACHE_TARGET(arch)
+#endif
+
+namespace bustache::parser { namespace
+{
+    namespace scalar
+    {
+        I skip_space(I i, I e) noexcept
+        {
+            while (i != e && is_space(*i))
+                ++i;
+            return i;
+        }
+
+        I find_either(I i, I e, char a, char b) noexcept
+        {
+            while (i != e && *i != a && *i != b)
+                ++i;
+            return i;
+        }
+
+        I find_key_stop(I i, I e, char a, char b) noexcept
+        {
+            while (i != e && *i != a && *i != b && *i != ':' && !is_space(*i))
+                ++i;
+            return i;
+        }
+    }
+
+    // Use tricks described here:
+    // http://0x80.pl/notesen/2023-03-06-swar-find-any.html
+    namespace swar
+    {
+        constexpr auto msb_mask = UINT64_C(0x8080808080808080);
+
+        constexpr std::uint64_t broadcast(std::uint8_t byte)
+        {
+            return UINT64_C(0x101010101010101) * byte;
+        }
+
+        constexpr bool is_ascii(char c)
+        {
+            return !(static_cast<unsigned char>(c) & 0x80u);
+        }
+
+        // Set the MSB of every byte in `word` that differs from `c`,
+        // which must be ASCII.
+        constexpr std::uint64_t differ(std::uint64_t word, char c)
+        {
+            constexpr auto mask = ~msb_mask;
+            return ((word & mask) ^ broadcast(static_cast<std::uint8_t>(c))) + mask;
+        }
+
+        // Set the MSB of every byte in `word` that equals one of `c...`.
+        template<class... C>
+        constexpr std::uint64_t match_any(std::uint64_t word, C... c)
+        {
+            return ~((... & differ(word, c)) | word) & msb_mask;
+        }
+
+        template<std::endian = std::endian::native>
+        constexpr unsigned zero_prefix(std::uint64_t mask);
+
+        template<>
+        constexpr unsigned zero_prefix<std::endian::little>(std::uint64_t mask)
+        {
+            return unsigned(std::countr_zero(mask)) >> 3u;
+        }
+
+        template<>
+        constexpr unsigned zero_prefix<std::endian::big>(std::uint64_t mask)
+        {
+            return unsigned(std::countl_zero(mask)) >> 3u;
+        }
+
+        inline std::uint64_t load(I i)
+        {
+            std::uint64_t word;
+            std::memcpy(&word, i, 8);
+            return word;
+        }
+
+        I skip_space(I i, I e) noexcept
+        {
+            for (; e - i >= 8; i += 8)
+            {
+                auto const word = load(i);
+                auto const len = zero_prefix(~match_any(word, ' ', '\f', '\n', '\r', '\t', '\v') & msb_mask);
+                if (len != 8)
+                    return i + len;
+            }
+            return scalar::skip_space(i, e);
+        }
+
+        I find_either(I i, I e, char a, char b) noexcept
+        {
+            if (is_ascii(a) && is_ascii(b))
+            {
+                for (; e - i >= 8; i += 8)
+                {
+                    if (auto const m = match_any(load(i), a, b))
+                        return i + zero_prefix(m);
+                }
+            }
+            return scalar::find_either(i, e, a, b);
+        }
+
+        I find_key_stop(I i, I e, char a, char b) noexcept
+        {
+            if (is_ascii(a) && is_ascii(b))
+            {
+                for (; e - i >= 8; i += 8)
+                {
+                    if (auto const m = match_any(load(i), a, b, ':', ' ', '\f', '\n', '\r', '\t', '\v'))
+                        return i + zero_prefix(m);
+                }
+            }
+            return scalar::find_key_stop(i, e, a, b);
+        }
+    }
+
+#ifdef BUSTACHE_KERNELS_X86
+    namespace sse42
+    {
+        // The explicit-length form is used so that NUL bytes in the
+        // template are not mistaken for the end of the string.
+        template<int Mode>
+        BUSTACHE_TARGET("sse4.2")
+        I find(I i, I e, char const (&set)[16], int n) noexcept
+        {
+            auto const needles = _mm_loadu_si128(reinterpret_cast<__m128i const*>(set));
+            for (; e - i >= 16; i += 16)
+            {
+                auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(i));
+                auto const idx = _mm_cmpestri(needles, n, v, 16, Mode);
+                if (idx != 16)
+                    return i + idx;
+            }
+            return e;
+        }
+
+        constexpr int find_mode = _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT;
+        constexpr int skip_mode = find_mode | _SIDD_NEGATIVE_POLARITY;
+
+        I skip_space(I i, I e) noexcept
+        {
+            if (i != e && !is_space(*i))
+                return i;
+            static constexpr char set[16] = {' ', '\f', '\n', '\r', '\t', '\v'};
+            auto const p = find<skip_mode>(i, e, set, 6);
+            return p != e ? p : scalar::skip_space(i + ((e - i) & ~15), e);
+        }
+
+        I find_either(I i, I e, char a, char b) noexcept
+        {
+            char const set[16] = {a, b};
+            auto const p = find<find_mode>(i, e, set, 2);
+            return p != e ? p : scalar::find_either(i + ((e - i) & ~15), e, a, b);
+        }
+
+        I find_key_stop(I i, I e, char a, char b) noexcept
+        {
+            char const set[16] = {a, b, ':', ' ', '\f', '\n', '\r', '\t', '\v'};
+            auto const p = find<find_mode>(i, e, set, 9);
+            return p != e ? p : scalar::find_key_stop(i + ((e - i) & ~15), e, a, b);
+        }
+    }
+
+    namespace avx2
+    {
+        BUSTACHE_TARGET("avx2")
+        inline __m256i load(I i) noexcept
+        {
+            return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(i));
+        }
+
+        BUSTACHE_TARGET("avx2")
+        inline __m256i spaces(__m256i v) noexcept
+        {
+            // '\t', '\n', '\v', '\f' and '\r' are contiguous.
+            auto const d = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+            auto const ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8('\r' - '\t')), d);
+            return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), ctrl);
+        }
+
+        BUSTACHE_TARGET("avx2")
+        inline unsigned bits(__m256i m) noexcept
+        {
+            return static_cast<unsigned>(_mm256_movemask_epi8(m));
+        }
+
+        BUSTACHE_TARGET("avx2")
+        I skip_space(I i, I e) noexcept
+        {
+            if (i != e && !is_space(*i))
+                return i;
+            for (; e - i >= 32; i += 32)
+            {
+                if (auto const m = ~bits(spaces(load(i))))
+                    return i + std::countr_zero(m);
+            }
+            return scalar::skip_space(i, e);
+        }
+
+        BUSTACHE_TARGET("avx2")
+        I find_either(I i, I e, char a, char b) noexcept
+        {
+            auto const va = _mm256_set1_epi8(a);
+            auto const vb = _mm256_set1_epi8(b);
+            for (; e - i >= 32; i += 32)
+            {
+                auto const v = load(i);
+                if (auto const m = bits(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb))))
+                    return i + std::countr_zero(m);
+            }
+            return scalar::find_either(i, e, a, b);
+        }
+
+        BUSTACHE_TARGET("avx2")
+        I find_key_stop(I i, I e, char a, char b) noexcept
+        {
+            auto const va = _mm256_set1_epi8(a);
+            auto const vb = _mm256_set1_epi8(b);
+            auto const vc = _mm256_set1_epi8(':');
+            for (; e - i >= 32; i += 32)
+            {
+                auto const v = load(i);
+                auto const m = _mm256_or_si256
+                (
+                    _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(v, vc), spaces(v))
+                );
+                if (auto const found = bits(m))
+                    return i + std::countr_zero(found);
+            }
+            return scalar::find_key_stop(i, e, a, b);
+        }
+    }
+#endif
+
+    constexpr kernel_table scalar_kernels
+    {
+        parser_kernel::scalar, scalar::skip_space, scalar::find_either, scalar::find_key_stop
+    };
+
+    constexpr kernel_table swar_kernels
+    {
+        parser_kernel::swar, swar::skip_space, swar::find_either, swar::find_key_stop
+    };
+
+#ifdef BUSTACHE_KERNELS_X86
+    constexpr kernel_table sse42_kernels
+    {
+        parser_kernel::sse42, sse42::skip_space, sse42::find_either, sse42::find_key_stop
+    };
+
+    constexpr kernel_table avx2_kernels
+    {
+        parser_kernel::avx2, avx2::skip_space, avx2::find_either, avx2::find_key_stop
+    };
+#endif
+
+    bool cpu_supports(parser_kernel kind) noexcept
+    {
+        switch (kind)
+        {
+        case parser_kernel::automatic:
+        case parser_kernel::scalar:
+        case parser_kernel::swar:
+            return true;
+#ifdef BUSTACHE_KERNELS_X86
+#   if defined(__GNUC__)
+        case parser_kernel::sse42:
+            return __builtin_cpu_supports("sse4.2");
+        case parser_kernel::avx2:
+            return __builtin_cpu_supports("avx2");
+#   elif defined(_MSC_VER)
+        case parser_kernel::sse42:
+        {
+            int info[4];
+            __cpuid(info, 1);
+            return info[2] & (1 << 20);
+        }
+        case parser_kernel::avx2:
+        {
+            int info[4];
+            __cpuid(info, 1);
+            // AVX state must be enabled by the OS (OSXSAVE + XCR0).
+            if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+                return false;
+            __cpuidex(info, 7, 0);
+            return info[1] & (1 << 5);
+        }
+#   endif
+#endif
+        default:
+            return false;
+        }
+    }
+
+    kernel_table const* get_table(parser_kernel kind) noexcept
+    {
+        switch (kind)
+        {
+        case parser_kernel::automatic:
+            // By bustache_parse_bench, only AVX2 pays off (about 1.5x over
+            // scalar), SWAR and SSE4.2 are within the noise of scalar on the
+            // short runs found in real templates, so they're not picked.
+            if (cpu_supports(parser_kernel::avx2))
+                return get_table(parser_kernel::avx2);
+            return &scalar_kernels;
+        case parser_kernel::scalar:
+            return &scalar_kernels;
+        case parser_kernel::swar:
+            return &swar_kernels;
+#ifdef BUSTACHE_KERNELS_X86
+        case parser_kernel::sse42:
+            return &sse42_kernels;
+        case parser_kernel::avx2:
+            return &avx2_kernels;
+#endif
+        default:
+            return nullptr;
+        }
+    }
+}}
+
+namespace bustache::parser
+{
+    std::atomic<kernel_table const*>& kernel_slot() noexcept
+    {
+        static std::atomic<kernel_table const*> slot{get_table(parser_kernel::automatic)};
+        return slot;
+    }
+}
+
+namespace bustache
+{
+    bool set_parser_kernel(parser_kernel kind) noexcept
+    {
+        if (!parser::cpu_supports(kind))
+            return false;
+        auto const table = parser::get_table(kind);
+        if (!table)
+            return false;
+        parser::kernel_slot().store(table, std::memory_order_relaxed);
+        return true;
+    }
+
+    parser_kernel get_parser_kernel() noexcept
+    {
+        return parser::kernels().kind;
+    }
+}
@@ -0,0 +1,44 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef BUSTACHE_SRC_PARSE_KERNELS_HPP_INCLUDED
+#define BUSTACHE_SRC_PARSE_KERNELS_HPP_INCLUDED
+
+#include <atomic>
+#include <bustache/format.hpp>
+#include <bustache/detail/parse_core.hpp>
+
+namespace bustache::parser
+{
+    using I = char const*;
+
+    using detail::parse_core::is_space;
+
+    // The byte-scanning primitives the parser is built on. Every function
+    // returns the first position in [i, e) that it stops at, or `e`.
+    struct kernel_table
+    {
+        parser_kernel kind;
+
+        // Stop at the first non-space.
+        I(*skip_space)(I i, I e) noexcept;
+
+        // Stop at the first `a` or `b`.
+        I(*find_either)(I i, I e, char a, char b) noexcept;
+
+        // Stop at the first space, ':', `a` or `b`.
+        I(*find_key_stop)(I i, I e, char a, char b) noexcept;
+    };
+
+    std::atomic<kernel_table const*>& kernel_slot() noexcept;
+
+    inline kernel_table const& kernels() noexcept
+    {
+        return *kernel_slot().load(std::memory_order_relaxed);
+    }
+}
+
+#endif
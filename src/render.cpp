@@ -6,8 +6,14 @@
 //////////////////////////////////////////////////////////////////////////////*/
 
 #include <bustache/render.hpp>
+#include <bustache/render/incremental.hpp>
+#include <bustache/fragment_cache.hpp>
+#include <algorithm>
 #include <cassert>
+#include <deque>
 #include <span>
+#include <string>
+#include <unordered_map>
 
 namespace bustache::detail
 {
@@ -15,21 +21,27 @@ namespace bustache::detail
     {
         void const* data;
         void(*_get)(void const* self, std::string_view key, value_handler visit);
+        bool fixed_keys; // See object_trait::fixed_keys.
+
+        static object_ptr from_vtable(void const* data, value_vtable const* vt)
+        {
+            return {data, vt->get, vt->fixed_keys};
+        }
 
         static object_ptr from(value_ptr val)
         {
             auto vptr = val.get_vptr();
             if (vptr->kind == model::object)
-                return {val.get_data(), static_cast<value_vtable const*>(vptr)->get};
-            return {nullptr, object_trait::get_default};
+                return from_vtable(val.get_data(), static_cast<value_vtable const*>(vptr));
+            return {nullptr, object_trait::get_default, true};
         }
 
         static object_ptr from_nested(value_ptr val)
         {
             auto vptr = val.get_vptr();
             if (vptr->kind < model::lazy_value)
-                return {val.get_data(), static_cast<value_vtable const*>(vptr)->get};
-            return {nullptr, object_trait::get_default};
+                return from_vtable(val.get_data(), static_cast<value_vtable const*>(vptr));
+            return {nullptr, object_trait::get_default, true};
         }
 
         constexpr explicit operator bool() const { return !!data; }
@@ -44,14 +56,58 @@ namespace bustache::detail
     {
         content_scope const* const parent;
         object_ptr data;
+        // Unique within a render, the data doesn't change while it lives.
+        std::uint64_t id;
+    };
+
+    // Remembers where the lookup of a node missed, so that those scopes are
+    // skipped the next time, e.g. the items of a loop when the key is found
+    // outside of it. A scope is remembered by its id, or by its type if the
+    // misses of that type don't depend on the instance.
+    struct lookup_cache
+    {
+        using get_fn = void(*)(void const*, std::string_view, value_handler);
+
+        std::uint64_t scopes[4] = {};
+        get_fn types[2] = {};
+        unsigned next_scope = 0;
+        unsigned next_type = 0;
+
+        bool skips(content_scope const& scope) const noexcept
+        {
+            if (scope.data.fixed_keys)
+                return types[0] == scope.data._get || types[1] == scope.data._get;
+            for (auto const id : scopes)
+            {
+                if (id == scope.id)
+                    return true;
+            }
+            return false;
+        }
+
+        void miss(content_scope const& scope) noexcept
+        {
+            if (scope.data.fixed_keys)
+            {
+                types[next_type] = scope.data._get;
+                next_type = (next_type + 1) % 2;
+            }
+            else
+            {
+                scopes[next_scope] = scope.id;
+                next_scope = (next_scope + 1) % 4;
+            }
+        }
     };
 
     template<class Visit>
-    void lookup(content_scope const* scope, std::string_view key, Visit const& visit)
+    void lookup(content_scope const* scope, std::string_view key, Visit const& visit, lookup_cache* cache = nullptr)
     {
         bool found = false;
         do
         {
+            if (cache && cache->skips(*scope))
+                continue;
             scope->data.get(key, [&](value_ptr val)
             {
                 if (val)
@@ -62,8 +118,9 @@ namespace bustache::detail
             });
             if (found)
                 return;
-            scope = scope->parent;
-        } while (scope);
+            if (cache)
+                cache->miss(*scope);
+        } while ((scope = scope->parent));
         visit(nullptr);
     }
 
@@ -79,7 +136,7 @@ namespace bustache::detail
     {
         using iter = char const*;
         subkey sub;
-        std::string& key_cache;
+        std::pmr::string& key_cache;
         value_handler handle;
         bool done;
 
@@ -112,18 +169,319 @@ namespace bustache::detail
         }
     };
 
-    struct override_context
+    // Like nested_resolver, over a name split by the parser.
+    struct path_resolver
     {
-        ast::override_map const* map;
-        ast::context const* ctx;
+        ast::context const& ctx;
+        ast::key_id const* i;
+        ast::key_id const* const e;
+        std::string_view key; // The last one looked up.
+        value_handler handle;
+        bool done;
+
+        void next(object_ptr obj)
+        {
+            key = ctx.key(*i);
+            if (++i != e)
+            {
+                return obj.get(key, [this](value_ptr val)
+                {
+                    if (auto const next_obj = object_ptr::from(val))
+                        next(next_obj);
+                });
+            }
+            obj.get(key, [this](value_ptr val)
+            {
+                if (val)
+                {
+                    handle(val);
+                    done = true;
+                }
+            });
+        }
     };
 
-    struct override_find_result
+    struct program;
+
+    // The overrider in effect for the inheritance blocks of a name.
+    struct override_slot
     {
-        ast::content_list const* found;
-        ast::context const* ctx;
+        ast::context const* ctx = nullptr; // Null if there's none.
+        ast::overrider const* overrider;
+        // The program of `ctx` and the entry of the overrider, for the bytecode.
+        program const* prog;
+        std::uint32_t entry;
+    };
+
+    // The bytecode of a document. The instructions refer to the nodes of its
+    // context by index, so a program can be shared by copies of a format.
+    enum class opcode : std::uint8_t
+    {
+        text, // a: text
+        var_escaped, // a: variable
+        var_raw,
+        // Fused for the common runs of nodes.
+        text_var_escaped, // a: text, b: variable
+        text_var_raw,
+        text_var_escaped_text, // a: text, b: variable, c: text
+        text_var_raw_text,
+        // Followed by the body, which ends with `ret`, b is after it.
+        section, // a: block, b: end
+        inversion,
+        filter,
+        loop,
+        cache,
+        // Followed by the default body, which is skipped to b if overridden.
+        inheritance, // a: block, b: end
+        partial, // a: partial
+        ret
+    };
+
+    struct instruction
+    {
+        opcode code;
+        std::uint32_t a = 0;
+        std::uint32_t b = 0;
+        std::uint32_t c = 0;
+    };
+
+    struct program
+    {
+        // Starts with the document.
+        std::vector<instruction> code;
+        // The entry of each overrider, as in context::overriders.
+        std::vector<std::vector<std::uint32_t>> overriders;
+    };
+
+    struct compiler
+    {
+        ast::context const& ctx;
+        program& prog;
+
+        std::uint32_t here() const noexcept
+        {
+            return std::uint32_t(prog.code.size());
+        }
+
+        void emit(opcode code, std::uint32_t a = 0, std::uint32_t b = 0, std::uint32_t c = 0)
+        {
+            prog.code.push_back({code, a, b, c});
+        }
+
+        static opcode block_opcode(ast::type kind) noexcept
+        {
+            switch (kind)
+            {
+            case ast::type::inversion: return opcode::inversion;
+            case ast::type::filter: return opcode::filter;
+            case ast::type::loop: return opcode::loop;
+            case ast::type::cache: return opcode::cache;
+            default: return opcode::section;
+            }
+        }
+
+        // Emit `contents` followed by `ret` and return where it starts.
+        std::uint32_t function(std::span<ast::content const> contents)
+        {
+            auto const entry = here();
+            emit_list(contents);
+            emit(opcode::ret);
+            return entry;
+        }
+
+        void emit_list(std::span<ast::content const> contents)
+        {
+            for (auto i = contents.begin(), e = contents.end(); i != e; ++i)
+            {
+                auto const c = *i;
+                switch (c.kind)
+                {
+                case ast::type::text:
+                    if (e - i > 1 && (i[1].kind == ast::type::var_escaped || i[1].kind == ast::type::var_raw))
+                    {
+                        bool const raw = i[1].kind == ast::type::var_raw;
+                        if (e - i > 2 && i[2].kind == ast::type::text)
+                        {
+                            emit(raw ? opcode::text_var_raw_text : opcode::text_var_escaped_text, c.index, i[1].index, i[2].index);
+                            i += 2;
+                        }
+                        else
+                        {
+                            emit(raw ? opcode::text_var_raw : opcode::text_var_escaped, c.index, i[1].index);
+                            ++i;
+                        }
+                    }
+                    else
+                        emit(opcode::text, c.index);
+                    break;
+                case ast::type::var_escaped:
+                    emit(opcode::var_escaped, c.index);
+                    break;
+                case ast::type::var_raw:
+                    emit(opcode::var_raw, c.index);
+                    break;
+                case ast::type::section:
+                case ast::type::inversion:
+                case ast::type::filter:
+                case ast::type::loop:
+                case ast::type::cache:
+                {
+                    auto const at = here();
+                    emit(block_opcode(c.kind), c.index);
+                    function(ctx.list(ctx.blocks[c.index].contents));
+                    prog.code[at].b = here();
+                    break;
+                }
+                case ast::type::inheritance:
+                {
+                    auto const at = here();
+                    emit(opcode::inheritance, c.index);
+                    emit_list(ctx.list(ctx.blocks[c.index].contents));
+                    prog.code[at].b = here();
+                    break;
+                }
+                case ast::type::partial:
+                    emit(opcode::partial, c.index);
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+    };
+
+    program compile(ast::context const& ctx, std::span<ast::content const> contents)
+    {
+        program ret;
+        compiler c{ctx, ret};
+        c.function(contents);
+        ret.overriders.resize(ctx.overriders.size());
+        for (std::size_t i = 0; i != ctx.overriders.size(); ++i)
+        {
+            for (auto const& o : ctx.overriders[i])
+                ret.overriders[i].push_back(c.function(ctx.list(o.contents)));
+        }
+        return ret;
+    }
+
+    // The lookup caches of a context, made for the render `render`.
+    struct cache_list
+    {
+        using allocator_type = std::pmr::polymorphic_allocator<>;
+
+        std::pmr::vector<lookup_cache> caches;
+        std::uint64_t render = 0;
+
+        explicit cache_list(allocator_type alloc) : caches(alloc) {}
+    };
+
+    // The partial found by a name, for the render `render`.
+    struct found_partial
+    {
+        format const* fmt;
+        std::uint64_t render;
+    };
+
+    // The id of a cached block, for the render `render`.
+    struct fragment_id
+    {
+        std::uint64_t id;
+        std::uint64_t render;
+    };
+
+    void hash_contents(ast::context const& ctx, std::span<ast::content const> contents, std::uint64_t& h);
+
+    // Identifies the contents of a block, as far as its output is concerned.
+    std::uint64_t hash_block(ast::context const& ctx, ast::block const& block)
+    {
+        std::uint64_t h = std::hash<std::string_view>{}(ctx.key(block.key));
+        hash_contents(ctx, ctx.list(block.contents), h);
+        return h;
+    }
+
+    void hash_contents(ast::context const& ctx, std::span<ast::content const> contents, std::uint64_t& h)
+    {
+        auto const mix = [&h](std::uint64_t v)
+        {
+            h ^= v + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+        };
+        auto const mix_key = [&](std::string_view key)
+        {
+            mix(std::hash<std::string_view>{}(key));
+            mix(key.size());
+        };
+        mix(contents.size());
+        for (auto const c : contents)
+        {
+            mix(std::uint64_t(c.kind));
+            switch (c.kind)
+            {
+            case ast::type::text:
+                mix_key(ctx.texts[c.index]);
+                break;
+            case ast::type::var_escaped:
+            case ast::type::var_raw:
+                mix_key(ctx.key(ctx.variables[c.index].key));
+                break;
+            case ast::type::section:
+            case ast::type::inversion:
+            case ast::type::filter:
+            case ast::type::loop:
+            case ast::type::inheritance:
+            case ast::type::cache:
+                mix(hash_block(ctx, ctx.blocks[c.index]));
+                break;
+            case ast::type::partial:
+            {
+                auto const& p = ctx.partials[c.index];
+                mix_key(ctx.key(p.key));
+                mix_key(p.indent == ast::npos ? std::string_view() : ctx.key(p.indent));
+                if (p.overriders != ast::npos)
+                {
+                    for (auto const& o : ctx.overriders[p.overriders])
+                    {
+                        mix_key(ctx.key(o.key));
+                        hash_contents(ctx, ctx.list(o.contents), h);
+                    }
+                }
+                break;
+            }
+            default:
+                break;
+            }
+        }
+    }
+
+    // See render_state.
+    struct render_buffers
+    {
+        std::pmr::string key_cache;
+        std::pmr::string indent;
+        std::pmr::unordered_map<ast::context const*, cache_list> caches;
+        // The names of the inheritance blocks, interned so that the overrider
+        // of a block is found in one step however deep the partials are.
+        std::pmr::unordered_map<std::pmr::string, std::uint32_t, ast::key_hash, std::equal_to<>> block_ids;
+        std::pmr::vector<override_slot> overrides;
+        // The ids whose slots are set by the partials being rendered.
+        std::pmr::vector<std::uint32_t> overridden;
+        // The answers of the context handler, which are assumed not to change
+        // within a render, so each name is asked for once.
+        std::pmr::unordered_map<std::pmr::string, found_partial, ast::key_hash, std::equal_to<>> partials;
+        std::pmr::unordered_map<ast::block const*, fragment_id> fragment_ids;
+        std::pmr::string fragment_key;
+        // Counts the renders, the caches not made for this one are stale.
+        std::uint64_t renders = 0;
+        bool busy = false;
+
+        explicit render_buffers(std::pmr::memory_resource* resource)
+            : key_cache(resource), indent(resource), caches(resource)
+            , block_ids(resource), overrides(resource), overridden(resource)
+            , partials(resource), fragment_ids(resource), fragment_key(resource)
+        {}
     };
 
+    struct machine;
+
     struct content_visitor
     {
         using result_type = void;
@@ -131,32 +489,79 @@ namespace bustache::detail
         ast::context const* ctx;
         content_scope const* scope;
         value_ptr cursor;
-        std::vector<override_context> chain;
-        mutable std::string key_cache;
+        std::pmr::string& key_cache;
 
         output_handler raw_os;
         output_handler escape_os;
         context_handler context;
         unresolved_handler variable_unresolved;
-        std::string indent;
+        std::pmr::string& indent;
         bool needs_indent;
+        // Set when rendering the bytecode, which runs the contents instead,
+        // `prog` is then that of `ctx`.
+        machine* vm = nullptr;
+        program const* prog = nullptr;
+        // Those of the variables then the blocks of `ctx`, if it lives
+        // through the render.
+        lookup_cache* caches = nullptr;
+        std::uint64_t last_scope;
+        render_buffers& buffers;
+        // Where the `{{@key}}` blocks are cached, if anywhere, and the switch
+        // of `raw_os` and `escape_os` then.
+        fragment_cache* fragments = nullptr;
+        output_switch* out = nullptr;
+        // Where the names looked up are logged, see incremental_render.
+        std::vector<std::string>* names = nullptr;
+        value_ptr root;
 
         content_visitor
         (
             ast::context const& ctx_param, content_scope const& scope_param, value_ptr cursor_param,
             output_handler raw_os_param, output_handler escape_os_param, context_handler context_param,
-            unresolved_handler f
+            unresolved_handler f, render_buffers& buffers_param
         )
             : ctx(&ctx_param), scope(&scope_param), cursor(cursor_param)
+            , key_cache(buffers_param.key_cache)
             , raw_os(raw_os_param), escape_os(escape_os_param), context(context_param)
             , variable_unresolved(f)
+            , indent(buffers_param.indent)
             , needs_indent()
-        {}
+            , last_scope(scope_param.id)
+            , buffers(buffers_param)
+        {
+            indent.clear();
+            // Left behind if the last render threw.
+            for (auto const id : buffers.overridden)
+                buffers.overrides[id] = {};
+            buffers.overridden.clear();
+            caches = caches_for(ctx_param);
+        }
 
         content_visitor(content_visitor const&) = delete;
 
+        lookup_cache* caches_for(ast::context const& c)
+        {
+            auto& list = buffers.caches.try_emplace(&c).first->second;
+            if (list.render != buffers.renders)
+            {
+                list.caches.assign(c.variables.size() + c.blocks.size(), {});
+                list.render = buffers.renders;
+            }
+            return list.caches.data();
+        }
+
+        lookup_cache* cache_of(ast::variable const* variable) const noexcept
+        {
+            return caches ? caches + (variable - ctx->variables.data()) : nullptr;
+        }
+
+        lookup_cache* cache_of(ast::block const* block) const noexcept
+        {
+            return caches ? caches + ctx->variables.size() + std::size_t(block - ctx->blocks.data()) : nullptr;
+        }
+
         template<class Visit>
-        void resolve(std::string_view key, Visit visit) const
+        void resolve(std::string_view key, Visit visit, lookup_cache* cache) const
         {
             auto ki = key.data();
             auto const ke = ki + key.size();
@@ -176,41 +581,72 @@ namespace bustache::detail
             lookup(scope, key_cache, [&visit, sub = subkey{ki, ke}](value_ptr val)
             {
                 visit(val, sub);
-            });
+            }, cache);
         }
 
-        void visit_within(ast::context const& new_ctx, ast::content_list const& contents)
+        void visit_within(ast::context const& new_ctx, std::span<ast::content const> contents, lookup_cache* new_caches);
+
+        // For a format made during the render, e.g. by a lambda, so it's not
+        // cached.
+        void visit_within(ast::document const& doc)
         {
-            auto const old_ctx = ctx;
-            ctx = &new_ctx;
-            for (auto const content : contents)
-                new_ctx.visit(*this, content);
-            ctx = old_ctx;
+            visit_within(doc.ctx, doc.contents, nullptr);
         }
 
-        void visit_within(ast::document const& doc)
+        override_slot const* find_override(std::string_view name) const
         {
-            visit_within(doc.ctx, doc.contents);
+            if (buffers.overridden.empty())
+                return nullptr;
+            auto const it = buffers.block_ids.find(name);
+            if (it == buffers.block_ids.end())
+                return nullptr;
+            auto const& slot = buffers.overrides[it->second];
+            return slot.ctx ? &slot : nullptr;
         }
 
-        override_find_result find_override(std::string const& key) const;
+        // Set the slots of the overriders of a partial not set yet, an outer
+        // partial's overrider wins.
+        void push_overrides(std::uint32_t group)
+        {
+            auto const& map = ctx->overriders[group];
+            for (std::size_t i = 0; i != map.size(); ++i)
+            {
+                auto const name = ctx->key(map[i].key);
+                auto it = buffers.block_ids.find(name);
+                if (it == buffers.block_ids.end())
+                {
+                    it = buffers.block_ids.emplace(name, std::uint32_t(buffers.overrides.size())).first;
+                    buffers.overrides.emplace_back();
+                }
+                auto& slot = buffers.overrides[it->second];
+                if (!slot.ctx)
+                {
+                    slot = {ctx, &map[i], prog, prog ? prog->overriders[group][i] : 0};
+                    buffers.overridden.push_back(it->second);
+                }
+            }
+        }
+
+        void pop_overrides(std::size_t n)
+        {
+            auto& overridden = buffers.overridden;
+            for (auto i = n; i != overridden.size(); ++i)
+                buffers.overrides[overridden[i]] = {};
+            overridden.resize(n);
+        }
 
         void print_value(output_handler os, value_ptr val, char const* sepc, bool interpolation);
 
         void handle_variable(ast::type tag, value_ptr val, char const* sepc);
 
-        void expand(ast::content_list const& contents)
-        {
-            for (auto const content : contents)
-                ctx->visit(*this, content);
-        }
+        void expand(std::span<ast::content const> contents);
 
-        void expand_on_object(ast::content_list const& contents, value_ptr val)
+        void expand_on_object(std::span<ast::content const> contents, value_ptr val)
         {
             auto const old_cursor = cursor;
             auto vptr = val.get_vptr();
-            object_ptr data{val.get_data(), static_cast<value_vtable const*>(vptr)->get};
-            content_scope curr{scope, data};
+            auto const data = object_ptr::from_vtable(val.get_data(), static_cast<value_vtable const*>(vptr));
+            content_scope curr{scope, data, ++last_scope};
             cursor = val;
             scope = &curr;
             expand(contents);
@@ -218,7 +654,7 @@ namespace bustache::detail
             cursor = old_cursor;
         }
 
-        void expand_on_value(ast::content_list const& contents, value_ptr val)
+        void expand_on_value(std::span<ast::content const> contents, value_ptr val)
         {
             if (val.get_vptr()->kind == model::object)
                 expand_on_object(contents, val);
@@ -229,17 +665,31 @@ namespace bustache::detail
             }
         }
 
-        bool expand_section(ast::type tag, ast::content_list const& contents, value_ptr val);
+        bool expand_section(ast::type tag, std::span<ast::content const> contents, value_ptr val);
 
         void handle_section(ast::type tag, ast::block const& block, value_ptr val);
 
-        void resolve_and_handle(std::string_view key, unresolved_handler unresolved, value_handler handle);
+        void log_name(std::string_view name)
+        {
+            // A name relative to the data itself depends on all of it, ".".
+            if (name.starts_with('.'))
+            {
+                if (cursor.get_data() == root.get_data() && cursor.get_vptr() == root.get_vptr())
+                    names->emplace_back(".");
+                return;
+            }
+            names->emplace_back(name);
+        }
+
+        void resolve_and_handle(std::string_view key, unresolved_handler unresolved, value_handler handle, lookup_cache* cache = nullptr);
+
+        void resolve_and_handle(std::span<ast::key_id const> path, unresolved_handler unresolved, value_handler handle, lookup_cache* cache);
 
-        std::string const& deref_dyn_name(std::string const& key)
+        std::string_view deref_dyn_name(std::string_view key)
         {
             if (key.starts_with('*'))
             {
-                std::string_view const s(key.data() + 1, key.size() - 1);
+                auto const s = key.substr(1);
                 resolve_and_handle(s, nullptr, [this](value_ptr val)
                 {
                     key_cache.clear();
@@ -259,56 +709,63 @@ namespace bustache::detail
         void operator()(ast::type tag, ast::variable const* variable)
         {
             char const* sepc = nullptr;
-            std::string_view key = variable->key;
+            auto key = ctx->key(variable->key);
             if (auto const split = variable->split)
             {
                 sepc = key.data() + (split + 1);
                 key = std::string_view(key.data(), split);
             }
-            resolve_and_handle(key, variable_unresolved, [=, this](value_ptr val)
+            auto const handle = [=, this](value_ptr val)
             {
                 handle_variable(tag, val, sepc);
-            });
+            };
+            auto const cache = cache_of(variable);
+            if (variable->path.size)
+                resolve_and_handle(ctx->path(variable->path), variable_unresolved, handle, cache);
+            else
+                resolve_and_handle(key, variable_unresolved, handle, cache);
         }
 
         void operator()(ast::type tag, ast::block const* block)
         {
             if (tag == ast::type::inheritance)
             {
-                auto const result = find_override(block->key);
-                if (result.found)
-                    visit_within(*result.ctx, *result.found);
+                if (auto const slot = find_override(ctx->key(block->key)))
+                    visit_within(*slot->ctx, slot->ctx->list(slot->overrider->contents), caches_for(*slot->ctx));
                 else
                 {
-                    for (auto const content : block->contents)
+                    for (auto const content : ctx->list(block->contents))
                         ctx->visit(*this, content);
                 }
             }
+            else if (tag == ast::type::cache)
+                expand_fragment(*block);
             else
             {
-                resolve_and_handle(block->key, nullptr, [&](value_ptr val)
+                auto const handle = [&](value_ptr val)
                 {
                     handle_section(tag, *block, val);
-                });
+                };
+                auto const cache = cache_of(block);
+                if (block->path.size)
+                    resolve_and_handle(ctx->path(block->path), nullptr, handle, cache);
+                else
+                    resolve_and_handle(ctx->key(block->key), nullptr, handle, cache);
             }
         }
 
+        void expand_fragment(ast::block const& block);
+
+        format const* find_partial(ast::partial const* partial);
+
+        template<class Run>
+        void enter_partial(ast::partial const* partial, Run run);
+
         void operator()(ast::type, ast::partial const* partial);
 
         void operator()(ast::type, void const*) const {} // never called
     };
 
-    override_find_result content_visitor::find_override(std::string const& key) const
-    {
-        for (auto const pm : chain)
-        {
-            auto const it = pm.map->find(key);
-            if (it != pm.map->end())
-                return {&it->second, pm.ctx};
-        }
-        return {};
-    }
-
     void content_visitor::print_value(output_handler os, value_ptr val, char const* sepc, bool interpolation)
     {
         auto vptr = val.get_vptr();
@@ -344,7 +801,7 @@ namespace bustache::detail
         print_value(tag == ast::type::var_raw ? raw_os : escape_os, val, sepc, true);
     }
 
-    bool content_visitor::expand_section(ast::type tag, ast::content_list const& contents, value_ptr val)
+    bool content_visitor::expand_section(ast::type tag, std::span<ast::content const> contents, value_ptr val)
     {
         bool inverted = false;
         auto vptr = val.get_vptr();
@@ -418,15 +875,15 @@ namespace bustache::detail
 
     void content_visitor::handle_section(ast::type tag, ast::block const& block, value_ptr val)
     {
-        if (expand_section(tag, block.contents, val))
-        {
-            for (auto const content : block.contents)
-                ctx->visit(*this, content);
-        }
+        auto const contents = ctx->list(block.contents);
+        if (expand_section(tag, contents, val))
+            expand(contents);
     }
 
-    void content_visitor::resolve_and_handle(std::string_view key, unresolved_handler unresolved, value_handler handle)
+    void content_visitor::resolve_and_handle(std::string_view key, unresolved_handler unresolved, value_handler handle, lookup_cache* cache)
     {
+        if (names)
+            log_name(key);
         resolve(key, [=, this](value_ptr val, subkey sub)
         {
             if (sub)
@@ -441,7 +898,44 @@ namespace bustache::detail
             else if (val)
                 return handle(val);
             handle(unresolved ? unresolved(key_cache) : nullptr);
-        });
+        }, cache);
+    }
+
+    void content_visitor::resolve_and_handle(std::span<ast::key_id const> path, unresolved_handler unresolved, value_handler handle, lookup_cache* cache)
+    {
+        auto const head = ctx->key(path.front());
+        if (names)
+        {
+            std::string name(head);
+            for (auto const id : path.subspan(1))
+            {
+                name += '.';
+                name += ctx->key(id);
+            }
+            log_name(name.empty() ? "." : name);
+        }
+        auto const resolved = [=, this](value_ptr val)
+        {
+            auto key = head;
+            if (path.size() > 1)
+            {
+                if (auto const obj = object_ptr::from_nested(val))
+                {
+                    path_resolver nested{*ctx, path.data() + 1, path.data() + path.size(), {}, handle, false};
+                    if (nested.next(obj), nested.done)
+                        return;
+                    key = nested.key;
+                }
+            }
+            else if (val)
+                return handle(val);
+            handle(unresolved ? unresolved(key) : nullptr);
+        };
+        // An empty head stands for the leading dot.
+        if (head.empty())
+            resolved(cursor);
+        else
+            lookup(scope, head, resolved, cache);
     }
 
     void content_visitor::operator()(ast::type, ast::text const* text)
@@ -458,56 +952,822 @@ namespace bustache::detail
         auto const in = indent.size();
         if (needs_indent)
             raw_os(std::span<const char>(ib, in));
-        auto i0 = i;
-        auto const e = i + (n - 1); // Don't flush indent on last newline.
-        while (i != e)
+        std::size_t i0 = 0;
+        // The indent isn't flushed on the last newline.
+        ctx->for_each_newline(static_cast<std::size_t>(text - ctx->texts.data()), [&](std::size_t pos)
+        {
+            raw_os(std::span<const char>(i + i0, pos + 1 - i0));
+            raw_os(std::span<const char>(ib, in));
+            i0 = pos + 1;
+        });
+        needs_indent = i[n - 1] == '\n';
+        raw_os(std::span<const char>(i + i0, n - i0));
+    }
+
+    void content_visitor::expand_fragment(ast::block const& block)
+    {
+        auto const contents = ctx->list(block.contents);
+        // The output of an indented one depends on where it's rendered.
+        if (!fragments || !indent.empty())
+            return expand(contents);
+        auto& key = buffers.fragment_key;
+        bool found = false;
+        auto const handle = [&](value_ptr val)
         {
-            if (*i++ == '\n')
+            // Objects, lists and lambdas print nothing to tell them apart.
+            if (!val || val.get_vptr()->kind != model::atom)
+                return;
+            key.clear();
+            print_value([&key](std::span<const char> data)
             {
-                raw_os(std::span<const char>(i0, static_cast<std::size_t>(i - i0)));
-                raw_os(std::span<const char>(ib, in));
-                i0 = i;
-            }
+                key.append(data.data(), data.size());
+            }, val, nullptr, false);
+            found = !key.empty();
+        };
+        auto const cache = cache_of(&block);
+        if (block.path.size)
+            resolve_and_handle(ctx->path(block.path), nullptr, handle, cache);
+        else
+            resolve_and_handle(ctx->key(block.key), nullptr, handle, cache);
+        // Not cached without a key that prints something.
+        if (!found)
+            return expand(contents);
+        auto& ids = buffers.fragment_ids.try_emplace(&block, fragment_id{0, 0}).first->second;
+        if (ids.render != buffers.renders)
+            ids = {hash_block(*ctx, block), buffers.renders};
+        auto id = ids.id;
+        // The overriders in effect may replace the inheritance blocks within.
+        for (auto const i : buffers.overridden)
+        {
+            auto const& slot = buffers.overrides[i];
+            std::uint64_t h = std::hash<std::string_view>{}(slot.ctx->key(slot.overrider->key));
+            hash_contents(*slot.ctx, slot.ctx->list(slot.overrider->contents), h);
+            id ^= h + 0x9e3779b97f4a7c15 + (id << 6) + (id >> 2);
+        }
+        if (fragments->load(id, key, out->to))
+            return;
+        // The key may be overwritten by the blocks inside.
+        std::pmr::string const name(key, key.get_allocator());
+        std::pmr::string output(key.get_allocator());
+        {
+            struct output_guard
+            {
+                output_switch& out;
+                output_handler const to;
+
+                ~output_guard()
+                {
+                    out.to = to;
+                }
+            } const guard{*out, out->to};
+            auto const record = [&output, to = guard.to](std::span<const char> data)
+            {
+                output.append(data.data(), data.size());
+                to(data);
+            };
+            out->to = record;
+            expand(contents);
         }
-        needs_indent = *i++ == '\n';
-        raw_os(std::span<const char>(i0, static_cast<std::size_t>(i - i0)));
+        fragments->store(id, name, output);
     }
 
-    void content_visitor::operator()(ast::type, ast::partial const* partial)
+    format const* content_visitor::find_partial(ast::partial const* partial)
     {
-        if (auto const opt_format = context(deref_dyn_name(partial->key)); opt_format)
+        auto const& links = ctx->links;
+        if (auto const i = static_cast<std::size_t>(partial - ctx->partials.data()); i < links.size() && links[i])
+            return links[i];
+        auto const name = deref_dyn_name(ctx->key(partial->key));
+        auto it = buffers.partials.find(name);
+        if (it == buffers.partials.end())
+            it = buffers.partials.emplace(name, found_partial{nullptr, 0}).first;
+        auto& found = it->second;
+        if (found.render != buffers.renders)
         {
-            auto const& doc = opt_format->get().doc();
+            auto const opt_format = context(name);
+            found = {opt_format ? &opt_format->get() : nullptr, buffers.renders};
+        }
+        return found.fmt;
+    }
+
+    template<class Run>
+    void content_visitor::enter_partial(ast::partial const* partial, Run run)
+    {
+        if (auto const fmt = find_partial(partial))
+        {
+            auto const& doc = fmt->doc();
             if (doc.contents.empty())
                 return;
             auto const old_size = indent.size();
-            auto const old_chain = chain.size();
+            auto const old_overridden = buffers.overridden.size();
             auto const old_scope = scope;
             auto const old_cursor = cursor;
-            indent += partial->indent;
-            needs_indent |= !partial->indent.empty();
-            if (!partial->overriders.empty())
-                chain.push_back({&partial->overriders, ctx});
-            visit_within(doc);
+            if (partial->indent != ast::npos)
+            {
+                indent += ctx->key(partial->indent);
+                needs_indent = true;
+            }
+            if (partial->overriders != ast::npos)
+                push_overrides(partial->overriders);
+            run(*fmt);
             scope = old_scope;
             cursor = old_cursor;
-            chain.resize(old_chain);
+            pop_overrides(old_overridden);
             indent.resize(old_size);
         }
     }
 
-    void render(output_handler raw_os, output_handler escape_os, format const& fmt, value_ptr data, context_handler context, unresolved_handler f)
+    void content_visitor::operator()(ast::type, ast::partial const* partial)
+    {
+        enter_partial(partial, [this](format const& fmt)
+        {
+            visit_within(fmt.doc().ctx, fmt.doc().contents, caches_for(fmt.doc().ctx));
+        });
+    }
+
+    struct linker
     {
-        content_scope scope{nullptr, object_ptr::from(data)};
+        static ast::context& ctx(format& fmt) noexcept
+        {
+            return fmt._doc.ctx;
+        }
+
+        static program const* compiled(format const& fmt) noexcept
+        {
+            return fmt._program.get();
+        }
+
+        static render_buffers* buffers(render_state& state) noexcept
+        {
+            return state._buffers.get();
+        }
+    };
+
+    // Runs a program, leaving the nodes to content_visitor. A section runs
+    // its body through content_visitor::expand, as many times as it takes.
+    struct machine
+    {
+        content_visitor& v;
+        // The body of the section being expanded.
+        std::uint32_t body;
+        // The programs made for the formats not compiled, during a render.
+        std::unordered_map<format const*, program> made;
+
+        program const& get(format const& fmt)
+        {
+            if (auto const p = linker::compiled(fmt))
+                return *p;
+            auto const [it, fresh] = made.try_emplace(&fmt);
+            if (fresh)
+                it->second = compile(fmt.doc().ctx, fmt.doc().contents);
+            return it->second;
+        }
+
+        void run(std::uint32_t pc);
+
+        void run_within(ast::context const& ctx, program const& p, std::uint32_t pc, lookup_cache* caches)
+        {
+            auto const old_ctx = v.ctx;
+            auto const old_prog = v.prog;
+            auto const old_caches = v.caches;
+            v.ctx = &ctx;
+            v.prog = &p;
+            v.caches = caches;
+            run(pc);
+            v.caches = old_caches;
+            v.prog = old_prog;
+            v.ctx = old_ctx;
+        }
+
+        void block(ast::type tag, ast::block const* block, std::uint32_t pc)
+        {
+            auto const old_body = body;
+            body = pc;
+            v(tag, block);
+            body = old_body;
+        }
+
+        bool run_override(std::string_view name)
+        {
+            if (auto const slot = v.find_override(name))
+            {
+                run_within(*slot->ctx, *slot->prog, slot->entry, v.caches_for(*slot->ctx));
+                return true;
+            }
+            return false;
+        }
+    };
+
+    void machine::run(std::uint32_t pc)
+    {
+        auto const& ctx = *v.ctx;
+        auto const code = v.prog->code.data();
+        for (;;)
+        {
+            auto const& i = code[pc];
+            switch (i.code)
+            {
+            case opcode::text:
+                v(ast::type::text, &ctx.texts[i.a]);
+                ++pc;
+                break;
+            case opcode::var_escaped:
+                v(ast::type::var_escaped, &ctx.variables[i.a]);
+                ++pc;
+                break;
+            case opcode::var_raw:
+                v(ast::type::var_raw, &ctx.variables[i.a]);
+                ++pc;
+                break;
+            case opcode::text_var_escaped:
+                v(ast::type::text, &ctx.texts[i.a]);
+                v(ast::type::var_escaped, &ctx.variables[i.b]);
+                ++pc;
+                break;
+            case opcode::text_var_raw:
+                v(ast::type::text, &ctx.texts[i.a]);
+                v(ast::type::var_raw, &ctx.variables[i.b]);
+                ++pc;
+                break;
+            case opcode::text_var_escaped_text:
+                v(ast::type::text, &ctx.texts[i.a]);
+                v(ast::type::var_escaped, &ctx.variables[i.b]);
+                v(ast::type::text, &ctx.texts[i.c]);
+                ++pc;
+                break;
+            case opcode::text_var_raw_text:
+                v(ast::type::text, &ctx.texts[i.a]);
+                v(ast::type::var_raw, &ctx.variables[i.b]);
+                v(ast::type::text, &ctx.texts[i.c]);
+                ++pc;
+                break;
+            case opcode::section:
+                block(ast::type::section, &ctx.blocks[i.a], pc + 1);
+                pc = i.b;
+                break;
+            case opcode::inversion:
+                block(ast::type::inversion, &ctx.blocks[i.a], pc + 1);
+                pc = i.b;
+                break;
+            case opcode::filter:
+                block(ast::type::filter, &ctx.blocks[i.a], pc + 1);
+                pc = i.b;
+                break;
+            case opcode::loop:
+                block(ast::type::loop, &ctx.blocks[i.a], pc + 1);
+                pc = i.b;
+                break;
+            case opcode::cache:
+                block(ast::type::cache, &ctx.blocks[i.a], pc + 1);
+                pc = i.b;
+                break;
+            case opcode::inheritance:
+                pc = run_override(ctx.key(ctx.blocks[i.a].key)) ? i.b : pc + 1;
+                break;
+            case opcode::partial:
+                v.enter_partial(&ctx.partials[i.a], [this](format const& fmt)
+                {
+                    run_within(fmt.doc().ctx, get(fmt), 0, v.caches_for(fmt.doc().ctx));
+                });
+                ++pc;
+                break;
+            case opcode::ret:
+                return;
+            }
+        }
+    }
+
+    void content_visitor::visit_within(ast::context const& new_ctx, std::span<ast::content const> contents, lookup_cache* new_caches)
+    {
+        if (vm)
+        {
+            // The format of a lambda, made for this render.
+            auto const p = compile(new_ctx, contents);
+            return vm->run_within(new_ctx, p, 0, new_caches);
+        }
+        auto const old_ctx = ctx;
+        auto const old_caches = caches;
+        ctx = &new_ctx;
+        caches = new_caches;
+        for (auto const content : contents)
+            new_ctx.visit(*this, content);
+        caches = old_caches;
+        ctx = old_ctx;
+    }
+
+    void content_visitor::expand(std::span<ast::content const> contents)
+    {
+        if (vm)
+            return vm->run(vm->body);
+        for (auto const content : contents)
+            ctx->visit(*this, content);
+    }
+
+    // Marks the buffers in use for the length of a render.
+    struct buffers_guard
+    {
+        render_buffers& buffers;
+
+        explicit buffers_guard(render_buffers& b) noexcept : buffers(b)
+        {
+            buffers.busy = true;
+        }
+
+        buffers_guard(buffers_guard const&) = delete;
+
+        ~buffers_guard()
+        {
+            buffers.busy = false;
+        }
+    };
+
+    // The buffers of `state` (or of the thread's own) for a new render, or
+    // `fresh` if those are in use.
+    render_buffers& acquire(render_state* state, std::optional<render_buffers>& fresh)
+    {
+        thread_local render_state own;
+        auto buffers = linker::buffers(state ? *state : own);
+        // Only made for a render within a render, or with a moved-from state.
+        if (!buffers || buffers->busy)
+            buffers = &fresh.emplace(buffers ? buffers->caches.get_allocator().resource() : std::pmr::get_default_resource());
+        // The contexts of the formats gone pile up in a long-lived state.
+        if (buffers->caches.size() > 256)
+            buffers->caches.clear();
+        if (buffers->partials.size() > 4096)
+            buffers->partials.clear();
+        if (buffers->fragment_ids.size() > 4096)
+            buffers->fragment_ids.clear();
+        if (buffers->block_ids.size() > 4096)
+        {
+            buffers->block_ids.clear();
+            buffers->overrides.clear();
+            buffers->overridden.clear();
+        }
+        ++buffers->renders;
+        return *buffers;
+    }
+
+    void render(output_handler raw_os, output_handler escape_os, format const& fmt, value_ptr data, context_handler context, unresolved_handler f, render_engine engine, render_state* state, fragment_cache* fragments, output_switch* out)
+    {
+        std::optional<render_buffers> fresh;
+        auto& buffers = acquire(state, fresh);
+        buffers_guard const guard(buffers);
+
+        content_scope scope{nullptr, object_ptr::from(data), 1};
         auto const& doc = fmt.doc();
-        content_visitor visitor{doc.ctx, scope, data, raw_os, escape_os, context, f};
+        content_visitor visitor{doc.ctx, scope, data, raw_os, escape_os, context, f, buffers};
+        visitor.fragments = fragments;
+        visitor.out = out;
+        if (engine == render_engine::bytecode)
+        {
+            machine vm{visitor, 0, {}};
+            visitor.vm = &vm;
+            vm.run_within(doc.ctx, vm.get(fmt), 0, visitor.caches);
+            return;
+        }
         for (auto const content : doc.contents)
             doc.ctx.visit(visitor, content);
     }
+
+    // Copies a document into a new context, replacing the variables and the
+    // sections found in the constants with what they render. Within a
+    // section on an object or a list, whose scope is gone when the result is
+    // rendered, a node that would see that scope can't be kept, the
+    // outermost such section is kept as is instead.
+    struct folder
+    {
+        // Renders the constants, into `folded`.
+        content_visitor& visitor;
+        std::string& folded;
+        ast::context to;
+        std::unordered_map<std::string_view, ast::key_id> keys;
+        std::deque<std::string> texts;
+        // The sections on an object or a list being folded.
+        unsigned pushed = 0;
+
+        enum class found
+        {
+            none,
+            lazy, // Lambdas aren't called.
+            value
+        };
+
+        ast::key_id key(ast::context const& from, ast::key_id id)
+        {
+            if (id == ast::npos)
+                return id;
+            auto const k = from.key(id);
+            if (auto const it = keys.find(k); it != keys.end())
+                return it->second;
+            auto const ret = to.add_key(k);
+            keys.emplace(k, ret);
+            return ret;
+        }
+
+        ast::path_ref path(ast::context const& from, ast::path_ref ref)
+        {
+            ast::path_ref ret{std::uint32_t(to.paths.size()), ref.size};
+            for (auto const id : from.path(ref))
+                to.paths.push_back(key(from, id));
+            return ret;
+        }
+
+        void flush(ast::content_list& out)
+        {
+            if (folded.empty())
+                return;
+            out.push_back(to.add(ast::text(texts.emplace_back(std::move(folded)))));
+            folded.clear();
+        }
+
+        // Call `f` with the value of the node if it's found in the constants.
+        template<class Node, class F>
+        found resolve(ast::context const& from, Node const& node, std::string_view name, F const& f)
+        {
+            // The current value is that of the data at first.
+            if (!pushed && name.starts_with('.'))
+                return found::none;
+            auto ret = found::none;
+            visitor.ctx = &from;
+            auto const handle = [&](value_ptr val)
+            {
+                if (!val)
+                    return;
+                if (val.get_vptr()->kind >= model::lazy_value)
+                {
+                    ret = found::lazy;
+                    return;
+                }
+                ret = found::value;
+                f(val);
+            };
+            if (node.path.size)
+                visitor.resolve_and_handle(from.path(node.path), nullptr, handle, nullptr);
+            else
+                visitor.resolve_and_handle(name, nullptr, handle, nullptr);
+            return ret;
+        }
+
+        void keep(ast::context const& from, ast::content c, ast::content_list& out);
+
+        bool copy(ast::context const& from, std::span<ast::content const> contents, ast::content_list& out);
+
+        bool fold_section(ast::context const& from, ast::type tag, std::span<ast::content const> contents, value_ptr val, ast::content_list& out);
+
+        bool fold_within(ast::context const& from, std::span<ast::content const> contents, value_ptr val, ast::content_list& out)
+        {
+            auto const old_scope = visitor.scope;
+            auto const old_cursor = visitor.cursor;
+            content_scope const curr{old_scope, object_ptr::from(val), ++visitor.last_scope};
+            if (val.get_vptr()->kind == model::object)
+                visitor.scope = &curr;
+            visitor.cursor = val;
+            bool const ok = copy(from, contents, out);
+            visitor.scope = old_scope;
+            visitor.cursor = old_cursor;
+            return ok;
+        }
+    };
+
+    void folder::keep(ast::context const& from, ast::content c, ast::content_list& out)
+    {
+        switch (c.kind)
+        {
+        case ast::type::text:
+            out.push_back(to.add(from.texts[c.index]));
+            break;
+        case ast::type::var_escaped:
+        case ast::type::var_raw:
+        {
+            auto const& v = from.variables[c.index];
+            out.push_back(to.add(c.kind, ast::variable{key(from, v.key), v.split, path(from, v.path)}));
+            break;
+        }
+        case ast::type::section:
+        case ast::type::inversion:
+        case ast::type::filter:
+        case ast::type::loop:
+        case ast::type::inheritance:
+        case ast::type::cache:
+        {
+            auto const& b = from.blocks[c.index];
+            ast::content_list list;
+            for (auto const i : from.list(b.contents))
+                keep(from, i, list);
+            auto const k = key(from, b.key);
+            auto const p = path(from, b.path);
+            out.push_back(to.add(c.kind, ast::block{k, to.add_list(list), p}));
+            break;
+        }
+        case ast::type::partial:
+        {
+            auto const& p = from.partials[c.index];
+            auto overriders = ast::npos;
+            if (p.overriders != ast::npos)
+            {
+                // Still sorted, the names are the same.
+                ast::override_map map;
+                for (auto const& o : from.overriders[p.overriders])
+                {
+                    ast::content_list list;
+                    for (auto const i : from.list(o.contents))
+                        keep(from, i, list);
+                    map.push_back({key(from, o.key), to.add_list(list)});
+                }
+                overriders = std::uint32_t(to.overriders.size());
+                to.overriders.push_back(std::move(map));
+            }
+            out.push_back(to.add(ast::partial{key(from, p.key), key(from, p.indent), overriders}));
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    bool folder::copy(ast::context const& from, std::span<ast::content const> contents, ast::content_list& out)
+    {
+        for (auto const c : contents)
+        {
+            switch (c.kind)
+            {
+            case ast::type::text:
+                out.push_back(to.add(from.texts[c.index]));
+                break;
+            case ast::type::var_escaped:
+            case ast::type::var_raw:
+            {
+                auto const& v = from.variables[c.index];
+                auto name = from.key(v.key);
+                char const* sepc = nullptr;
+                if (v.split)
+                {
+                    sepc = name.data() + (v.split + 1);
+                    name = name.substr(0, v.split);
+                }
+                auto const os = c.kind == ast::type::var_raw ? visitor.raw_os : visitor.escape_os;
+                auto const f = resolve(from, v, name, [&](value_ptr val)
+                {
+                    visitor.print_value(os, val, sepc, true);
+                });
+                if (f == found::value)
+                {
+                    flush(out);
+                    break;
+                }
+                // A dotted name may be found in a scope that is gone.
+                if (pushed && (f == found::lazy || name.find('.') != name.npos))
+                    return false;
+                keep(from, c, out);
+                break;
+            }
+            case ast::type::section:
+            case ast::type::inversion:
+            case ast::type::filter:
+            case ast::type::loop:
+            {
+                auto const& b = from.blocks[c.index];
+                auto const name = from.key(b.key);
+                bool ok = false;
+                auto const f = resolve(from, b, name, [&](value_ptr val)
+                {
+                    ok = fold_section(from, c.kind, from.list(b.contents), val, out);
+                });
+                if (f == found::value && ok)
+                    break;
+                if (pushed && (f != found::none || name.find('.') != name.npos))
+                    return false;
+                // Doesn't make a scope, so its contents are folded likewise.
+                if (f == found::none && c.kind == ast::type::inversion)
+                {
+                    ast::content_list list;
+                    if (!copy(from, from.list(b.contents), list))
+                        return false;
+                    auto const k = key(from, b.key);
+                    auto const p = path(from, b.path);
+                    out.push_back(to.add(c.kind, ast::block{k, to.add_list(list), p}));
+                    break;
+                }
+                // A section on the rest of the data may hide the constants.
+                if (pushed)
+                    return false;
+                keep(from, c, out);
+                break;
+            }
+            case ast::type::inheritance:
+            case ast::type::cache:
+            {
+                // An override or a cached output would be rendered without
+                // the scope.
+                if (pushed)
+                    return false;
+                auto const& b = from.blocks[c.index];
+                ast::content_list list;
+                // Doesn't fail without a scope, but checked like the others.
+                if (!copy(from, from.list(b.contents), list))
+                    return false;
+                auto const k = key(from, b.key);
+                auto const p = path(from, b.path);
+                out.push_back(to.add(c.kind, ast::block{k, to.add_list(list), p}));
+                break;
+            }
+            case ast::type::partial:
+                if (pushed)
+                    return false;
+                keep(from, c, out);
+                break;
+            default:
+                break;
+            }
+        }
+        return true;
+    }
+
+    // Like content_visitor::expand_section. Return false if the section
+    // can't be folded.
+    bool folder::fold_section(ast::context const& from, ast::type tag, std::span<ast::content const> contents, value_ptr val, ast::content_list& out)
+    {
+        auto const vt = static_cast<value_vtable const*>(val.get_vptr());
+        auto kind = vt->kind;
+        bool inverted = false;
+        switch (tag)
+        {
+        case ast::type::inversion:
+            inverted = true;
+            [[fallthrough]];
+        case ast::type::filter:
+            kind = model::atom;
+            break;
+        case ast::type::loop:
+            kind = model::list;
+            break;
+        default:
+            break;
+        }
+        switch (kind)
+        {
+        case model::null:
+            return !inverted || copy(from, contents, out);
+        case model::atom:
+            return !(vt->test(val.get_data()) ^ inverted) || copy(from, contents, out);
+        default:
+            break;
+        }
+        auto const old_size = out.size();
+        bool ok = true;
+        ++pushed;
+        if (kind == model::object || !vt->iterate)
+            ok = fold_within(from, contents, val, out);
+        else
+        {
+            vt->iterate(val.get_data(), [&](value_ptr item_val)
+            {
+                if (ok)
+                    ok = fold_within(from, contents, item_val, out);
+            });
+        }
+        --pushed;
+        if (!ok)
+            out.resize(old_size);
+        return ok;
+    }
+
+    format fold_constants(output_handler raw_os, output_handler escape_os, std::string& folded, format const& fmt, value_ptr constants)
+    {
+        render_buffers buffers(std::pmr::get_default_resource());
+        content_scope scope{nullptr, object_ptr::from(constants), 1};
+        auto const& doc = fmt.doc();
+        content_visitor visitor{doc.ctx, scope, constants, raw_os, escape_os, no_context, nullptr, buffers};
+        folder f{visitor, folded, {}, {}, {}};
+        ast::document out;
+        f.copy(doc.ctx, doc.contents, out.contents);
+        out.ctx = std::move(f.to);
+        // The texts refer to `f` and to `fmt` until copied here.
+        format ret(std::move(out), false);
+        ret.optimize();
+        return ret;
+    }
+}
+
+namespace bustache
+{
+    namespace
+    {
+        // Whether a change to `changed` may change what the names looked
+        // up give, i.e. one of them is it, or its parent or member.
+        bool affected(std::span<std::string const> names, std::span<std::string_view const> changed)
+        {
+            for (std::string_view const name : names)
+            {
+                if (name == ".")
+                    return true;
+                for (auto const c : changed)
+                {
+                    auto const& [shorter, longer] = name.size() < c.size() ? std::pair{name, c} : std::pair{c, name};
+                    if (longer.starts_with(shorter) && (longer.size() == shorter.size() || longer[shorter.size()] == '.'))
+                        return true;
+                }
+            }
+            return false;
+        }
+    }
+
+    void incremental_render::run
+    (
+        output_handler raw_os, output_handler escape_os, value_ptr data,
+        context_handler context, unresolved_handler f,
+        std::span<std::string_view const> const* changed, std::vector<output_patch>* patches
+    )
+    {
+        using namespace detail;
+        std::optional<render_buffers> fresh;
+        auto& buffers = acquire(nullptr, fresh);
+        buffers_guard const guard(buffers);
+
+        content_scope scope{nullptr, object_ptr::from(data), 1};
+        auto const& doc = _fmt->doc();
+        content_visitor visitor{doc.ctx, scope, data, raw_os, escape_os, context, f, buffers};
+        visitor.root = data;
+        auto const n = doc.contents.size();
+        // Everything is rendered the first time.
+        bool const full = !changed || _regions.size() != n;
+        // Kept apart until all is rendered, in case it throws.
+        std::vector<region> regions(n);
+        std::vector<bool> kept(n);
+        std::string next;
+        next.reserve(_output.size());
+        for (std::size_t i = 0; i != n; ++i)
+        {
+            auto& r = regions[i];
+            if (!full && !affected(_regions[i].names, *changed))
+            {
+                auto const& old = _regions[i];
+                r.offset = next.size();
+                r.size = old.size;
+                next.append(_output, old.offset, old.size);
+                kept[i] = true;
+                continue;
+            }
+            visitor.names = &r.names;
+            _buffer.clear();
+            doc.ctx.visit(visitor, doc.contents[i]);
+            std::sort(r.names.begin(), r.names.end());
+            r.names.erase(std::unique(r.names.begin(), r.names.end()), r.names.end());
+            if (patches && !full)
+            {
+                auto const& old = _regions[i];
+                if (std::string_view(_output).substr(old.offset, old.size) != _buffer)
+                    patches->push_back({old.offset, old.size, _buffer});
+            }
+            r.offset = next.size();
+            r.size = _buffer.size();
+            next += _buffer;
+        }
+        if (patches && full && _output != next)
+            patches->push_back({0, _output.size(), next});
+        for (std::size_t i = 0; i != n; ++i)
+        {
+            if (kept[i])
+                regions[i].names = std::move(_regions[i].names);
+        }
+        _regions = std::move(regions);
+        _output = std::move(next);
+    }
+
+    render_state::render_state() : render_state(std::pmr::get_default_resource()) {}
+
+    render_state::render_state(std::pmr::memory_resource* resource)
+        : _buffers(new detail::render_buffers(resource))
+    {}
+
+    render_state::render_state(render_state&& other) noexcept = default;
+
+    render_state& render_state::operator=(render_state&& other) noexcept = default;
+
+    render_state::~render_state() = default;
+
+    void format::compile()
+    {
+        _program = std::make_shared<detail::program const>(detail::compile(_doc.ctx, _doc.contents));
+    }
 }
 
 namespace bustache
 {
+    void link(format& fmt, context_handler context)
+    {
+        auto& ctx = detail::linker::ctx(fmt);
+        std::pmr::vector<format const*> links(ctx.partials.size(), ctx.get_allocator());
+        for (std::size_t i = 0; i != links.size(); ++i)
+        {
+            auto const key = ctx.key(ctx.partials[i].key);
+            if (key.starts_with('*'))
+                continue;
+            if (auto const opt_format = context(key))
+                links[i] = &opt_format->get();
+        }
+        ctx.links = std::move(links);
+    }
+
     void impl_print<std::string_view>::print(std::string_view self, output_handler os, char const* spec)
     {
         if (spec)
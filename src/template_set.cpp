@@ -0,0 +1,143 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <atomic>
+#include <thread>
+#include <fstream>
+#include <algorithm>
+#include <exception>
+#include <bustache/template_set.hpp>
+#include <bustache/render.hpp>
+
+namespace bustache { namespace
+{
+    std::string make_message(std::vector<template_set_error::failure> const& failures)
+    {
+        std::string ret = "bustache: " + std::to_string(failures.size()) + " template(s) failed to parse";
+        for (auto const& f : failures)
+        {
+            ret += "\n  ";
+            ret += f.file.string();
+            ret += ':';
+            ret += std::to_string(f.position);
+            ret += ": ";
+            ret += format_error(f.code, f.position).what();
+        }
+        return ret;
+    }
+
+    std::string read_file(std::filesystem::path const& file)
+    {
+        std::ifstream in(file, std::ios::binary);
+        if (!in)
+            throw std::runtime_error("bustache: cannot open " + file.string());
+        std::string ret;
+        in.seekg(0, std::ios::end);
+        auto const n = in.tellg();
+        if (n > 0)
+        {
+            ret.resize(static_cast<std::size_t>(n));
+            in.seekg(0);
+            in.read(ret.data(), n);
+        }
+        if (in.bad())
+            throw std::runtime_error("bustache: cannot read " + file.string());
+        return ret;
+    }
+
+    // The outcome of a single file.
+    struct job
+    {
+        std::filesystem::path file;
+        std::string name;
+        std::optional<format> result;
+        std::optional<template_set_error::failure> failure;
+        std::exception_ptr exception;
+    };
+
+    void run(job& j)
+    {
+        try
+        {
+            j.result.emplace(read_file(j.file), true);
+        }
+        catch (format_error const& e)
+        {
+            j.failure = {j.file, e.code(), e.position()};
+        }
+        catch (...)
+        {
+            j.exception = std::current_exception();
+        }
+    }
+}}
+
+namespace bustache
+{
+    template_set_error::template_set_error(std::vector<failure> failures)
+      : runtime_error(make_message(failures)), _failures(std::move(failures))
+    {}
+
+    template_set template_set::load(std::filesystem::path const& root, std::string_view extension, unsigned threads)
+    {
+        std::vector<job> jobs;
+        for (auto const& entry : std::filesystem::recursive_directory_iterator(root))
+        {
+            if (!entry.is_regular_file())
+                continue;
+            auto name = entry.path().lexically_relative(root).generic_string();
+            if (!std::string_view(name).ends_with(extension))
+                continue;
+            name.resize(name.size() - extension.size());
+            jobs.push_back({entry.path(), std::move(name), {}, {}, {}});
+        }
+        // Report failures in a stable order.
+        std::sort(jobs.begin(), jobs.end(), [](job const& a, job const& b) { return a.name < b.name; });
+
+        if (!threads)
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+        threads = static_cast<unsigned>(std::min<std::size_t>(threads, jobs.size()));
+        std::atomic<std::size_t> next{0};
+        auto const work = [&]
+        {
+            for (std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < jobs.size();)
+                run(jobs[i]);
+        };
+        // Joined on destruction, so one failing to start leaves none running.
+        std::vector<std::jthread> pool;
+        if (threads)
+        {
+            pool.reserve(threads - 1);
+            for (unsigned i = 1; i < threads; ++i)
+                pool.emplace_back(work);
+        }
+        work(); // run() doesn't throw.
+        for (auto& t : pool)
+            t.join();
+
+        template_set ret;
+        std::vector<template_set_error::failure> failures;
+        ret._map.reserve(jobs.size());
+        for (auto& j : jobs)
+        {
+            if (j.exception)
+                std::rethrow_exception(j.exception);
+            if (j.failure)
+                failures.push_back(std::move(*j.failure));
+            else
+                ret._map.emplace(std::move(j.name), std::move(*j.result));
+        }
+        if (!failures.empty())
+            throw template_set_error(std::move(failures));
+        return ret;
+    }
+
+    void template_set::link()
+    {
+        for (auto& [name, fmt] : _map)
+            bustache::link(fmt, *this);
+    }
+}
@@ -0,0 +1,43 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <type_traits>
+#include <catch2/catch_test_macros.hpp>
+#include <bustache/render/string.hpp>
+#include "model.hpp"
+
+using namespace bustache;
+using namespace test;
+
+// The nodes are kept in flat pools, and saved as is in an image.
+static_assert(std::is_trivially_copyable_v<ast::content>);
+static_assert(std::is_trivially_copyable_v<ast::variable>);
+static_assert(std::is_trivially_copyable_v<ast::block>);
+static_assert(std::is_trivially_copyable_v<ast::partial>);
+
+TEST_CASE("ast-key-pool")
+{
+    // Repeated names share one pooled key.
+    auto const fmt = "{{a}}{{#a}}{{a}}{{/a}}{{#b:a}}{{/b}}{{a:x}}"_fmt;
+    auto const& ctx = fmt.doc().ctx;
+    REQUIRE(ctx.key_ends.size() == 2);
+    CHECK(ctx.key(0) == "a");
+    CHECK(ctx.key(1) == "a:x");
+    for (auto const& var : ctx.variables)
+        CHECK(ctx.key(var.key).starts_with("a"));
+}
+
+TEST_CASE("ast-list-pool")
+{
+    // Section contents are stored in one pool.
+    auto const fmt = "{{#a}}1{{#b}}2{{c}}{{/b}}{{/a}}{{^d}}3{{/d}}"_fmt;
+    auto const& ctx = fmt.doc().ctx;
+    std::size_t n = 0;
+    for (auto const& block : ctx.blocks)
+        n += block.contents.size;
+    CHECK(ctx.lists.size() == n);
+    CHECK(to_string(fmt(object{{"a", true}, {"b", true}, {"c", "C"}})) == "12C3");
+}
@@ -114,6 +114,21 @@ TEST_CASE("boundary_tests_nesting_depth", "[boundary]")
         
         CHECK(to_string("{{#nested}}{{#.}}{{#.}}{{.}}{{/.}}{{/.}}{{/nested}}"_fmt(data)) == "12");
     }
+
+    SECTION("parsing very deep nesting doesn't consume native stack")
+    {
+        std::size_t const depth = 100000;
+        std::string tmpl;
+        for (std::size_t i = 0; i != depth; ++i)
+            tmpl += "{{#a}}\n";
+        tmpl += "x\n";
+        for (std::size_t i = 0; i != depth; ++i)
+            tmpl += "{{/a}}\n";
+        format const fmt(tmpl);
+        CHECK(fmt.doc().contents.size() == 1);
+        CHECK(fmt.doc().ctx.blocks.size() == depth);
+        CHECK(fmt.doc().ctx.texts.size() == 1);
+    }
 }
 
 TEST_CASE("boundary_tests_whitespace_handling", "[boundary]")
@@ -137,4 +152,41 @@ TEST_CASE("boundary_tests_whitespace_handling", "[boundary]")
         object data{{"show", false}};
         CHECK(to_string("  {{#show}}  text  {{/show}}  "_fmt(data)) == "    ");
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE("boundary_tests_long_text_runs", "[boundary]")
+{
+    SECTION("tags after long static runs are found")
+    {
+        object data{{"x", "X"}};
+        std::string const run(100, 'a');
+        for (std::size_t n = 0; n != 70; ++n)
+        {
+            std::string const prefix(run, 0, n);
+            CHECK(to_string(format(prefix + "{{x}}" + prefix)(data)) == prefix + "X" + prefix);
+        }
+    }
+
+    SECTION("lone delimiter bytes in static runs are kept")
+    {
+        object data{{"x", "X"}};
+        std::string const tmpl = std::string(40, 'a') + "{ {" + std::string(40, 'b') + "{{x}}{";
+        CHECK(to_string(format(tmpl)(data)) == std::string(40, 'a') + "{ {" + std::string(40, 'b') + "X{");
+    }
+
+    SECTION("standalone lines after long static runs")
+    {
+        object data{{"show", true}};
+        std::string const line = std::string(50, 'a') + "\n";
+        std::string const tmpl = line + "  {{#show}}\n" + line + "  {{/show}}\n" + line;
+        CHECK(to_string(format(tmpl)(data)) == line + line + line);
+    }
+
+    SECTION("custom delimiters after long static runs")
+    {
+        object data{{"x", "X"}};
+        std::string const run(40, 'a');
+        std::string const tmpl = "{{=<% %>=}}" + run + "<%x%>" + run + "<<%x%>";
+        CHECK(to_string(format(tmpl)(data)) == run + "X" + run + "<X");
+    }
+}
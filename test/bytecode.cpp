@@ -0,0 +1,78 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <catch2/catch_test_macros.hpp>
+#include <bustache/render/string.hpp>
+#include "model.hpp"
+
+// The spec tests again, rendered with the bytecode.
+#define to_string(...) to_string((__VA_ARGS__).engine(render_engine::bytecode))
+#include "specs.cpp"
+#include "inheritance.cpp"
+#include "dynamic_names.cpp"
+#undef to_string
+
+namespace
+{
+    std::string render(format const& fmt, value_ref data, context const& partials, render_engine engine)
+    {
+        std::string ret;
+        render_string(ret, fmt, data, partials, no_escape, nullptr, engine);
+        return ret;
+    }
+}
+
+TEST_CASE("bytecode-same-output")
+{
+    context const partials
+    {
+        {"item", "<{{.}}>\n"_fmt},
+        {"parent", "[{{$a}}A{{/a}}|{{$b}}{{>item}}{{/b}}]"_fmt},
+        {"child", "{{<parent}}{{$a}}{{name}}{{/a}}{{/parent}}"_fmt}
+    };
+    object const data{{"name", "N"}, {"list", array{1, 2}}, {"flag", false}};
+    char const* const sources[] =
+    {
+        "a{{name}}b{{{name}}}c{{&name}}",
+        "{{name}}{{name}}",
+        "{{#list}}x{{.}}y{{/list}}{{^list}}none{{/list}}",
+        "{{^flag}}a{{#flag}}b{{/flag}}c{{/flag}}",
+        "{{#list}}\n  {{>item}}\n{{/list}}",
+        "{{<parent}}{{$b}}{{#list}}{{.}}{{/list}}{{/b}}{{/parent}}",
+        "{{>child}}",
+        "{{$a}}default{{/a}}"
+    };
+    for (auto const source : sources)
+    {
+        INFO(source);
+        format fmt(source);
+        auto const expected = render(fmt, data, partials, render_engine::tree);
+        CHECK(render(fmt, data, partials, render_engine::bytecode) == expected);
+        fmt.compile();
+        CHECK(render(fmt, data, partials, render_engine::bytecode) == expected);
+    }
+}
+
+TEST_CASE("bytecode-compiled")
+{
+    format fmt("a{{x}}", editable);
+    CHECK(!fmt.compiled());
+    fmt.compile();
+    CHECK(fmt.compiled());
+
+    // Shared by a copy.
+    format const copy(fmt);
+    CHECK(copy.compiled());
+    CHECK(to_string(copy(object{{"x", 1}}).engine(render_engine::bytecode)) == "a1");
+
+    // Discarded when the document changes.
+    fmt.edit({1, 0, "b"});
+    CHECK(!fmt.compiled());
+    CHECK(to_string(fmt(object{{"x", 1}}).engine(render_engine::bytecode)) == "ab1");
+    fmt.compile();
+    fmt.optimize();
+    CHECK(!fmt.compiled());
+}
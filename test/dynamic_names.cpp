@@ -156,4 +156,29 @@ TEST_CASE("dynamic-names") {
     CHECK(to_string("|{{> * dynamic }}|"_fmt(
                         object{{"dynamic", "partial"}, {"boolean", true}})
                         .context(context{{"partial", "[]"_fmt}})) == "|[]|");
-}
\ No newline at end of file
+}
+
+TEST_CASE("dynamic-names-memoized") {
+    context partials{{"a", "A{{n}}"_fmt}, {"b", "B{{n}}"_fmt}};
+    std::vector<std::string> asked;
+    auto const counting = [&](std::string_view key) {
+        asked.emplace_back(key);
+        return partials(key);
+    };
+    object const data{{"items", array{object{{"kind", "a"}, {"n", 1}},
+                                      object{{"kind", "b"}, {"n", 2}},
+                                      object{{"kind", "a"}, {"n", 3}},
+                                      object{{"kind", "c"}, {"n", 4}},
+                                      object{{"kind", "c"}, {"n", 5}}}}};
+    auto const fmt = "{{#items}}{{>*kind}}{{>a}},{{/items}}"_fmt;
+
+    // Each name is asked for once a render, misses included.
+    CHECK(to_string(fmt(data).context(counting)) == "A1A1,B2A2,A3A3,A4,A5,");
+    CHECK(asked == std::vector<std::string>{"a", "b", "c"});
+
+    // A new render asks again.
+    asked.clear();
+    partials.emplace("c", "C{{n}}"_fmt);
+    CHECK(to_string(fmt(data).context(counting)) == "A1A1,B2A2,A3A3,C4A4,C5A5,");
+    CHECK(asked == std::vector<std::string>{"a", "b", "c"});
+}
@@ -0,0 +1,108 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <catch2/catch_test_macros.hpp>
+#include <bustache/render/string.hpp>
+#include "model.hpp"
+
+using namespace bustache;
+using namespace test;
+
+namespace
+{
+    std::size_t count_nodes(format const& fmt)
+    {
+        auto const& ctx = fmt.doc().ctx;
+        return ctx.variables.size() + ctx.blocks.size() + ctx.partials.size();
+    }
+
+    object merge(object a, object const& b)
+    {
+        a.insert(a.end(), b.begin(), b.end());
+        return a;
+    }
+}
+
+TEST_CASE("fold-constants")
+{
+    object const constants
+    {
+        {"site", "<Site>"},
+        {"beta", true},
+        {"legacy", false},
+        {"nav", array{object{{"label", "Home"}, {"url", "/"}}, object{{"label", "About"}, {"url", "/about"}}}},
+        {"tags", array{"a", "b"}},
+        {"locale", object{{"hello", "Hi"}, {"bye", "Bye"}}},
+        {"price", 2.5},
+        {"none", array{}}
+    };
+    object const request
+    {
+        {"user", object{{"name", "Ann"}, {"title", "Dr"}}},
+        {"title", "Page"},
+        {"items", array{1, 2}}
+    };
+    auto const data = merge(constants, request);
+    context const partials{{"footer", "[{{site}}|{{title}}]"_fmt}};
+    char const* const sources[] =
+    {
+        "{{site}} {{{site}}} {{&site}}",
+        "{{locale.hello}}, {{#user}}{{name}}{{/user}}! {{locale.bye}}",
+        "{{#beta}}beta {{title}}{{/beta}}{{#legacy}}legacy{{/legacy}}{{^legacy}}modern{{/legacy}}",
+        "{{#nav}}<a href=\"{{url}}\">{{label}}</a>{{/nav}}",
+        "{{#nav}}{{label}}:{{title}};{{/nav}}",
+        "{{#tags}}[{{.}}]{{/tags}}{{^none}}no{{/none}}{{#none}}x{{/none}}",
+        "{{#locale}}{{hello}} {{title}}{{/locale}}",
+        "{{#user}}{{site}} {{name}}{{/user}}",
+        "{{#nav}}{{#user}}{{label}}{{name}}{{/user}}{{/nav}}",
+        "{{#nav}}{{>footer}}{{/nav}}|{{>footer}}",
+        "{{#items}}{{.}}{{site}}{{/items}}{{^missing}}{{site}}{{/missing}}",
+        "{{.}}{{#nav}}{{.}}{{/nav}}",
+        "{{price:.2f}} {{price}}",
+        "{{<footer}}{{$x}}{{site}}{{/x}}{{/footer}}{{$y}}{{site}}{{/y}}",
+        "{{#nav}}{{$block}}{{label}}{{/block}}{{/nav}}",
+        "{{#nav}}{{#label}}{{missing.key}}{{/label}}{{/nav}}",
+    };
+    for (auto const src : sources)
+    {
+        INFO(src);
+        format const fmt(src);
+        auto const expected = to_string(fmt(data).context(partials).escape(escape_html));
+        auto const folded = fold_constants(fmt, constants, escape_html);
+        CHECK(to_string(folded(data).context(partials).escape(escape_html)) == expected);
+        CHECK(count_nodes(folded) <= count_nodes(fmt));
+    }
+
+    // Nothing left to render.
+    format const page("<title>{{site}}</title>{{#nav}}<a href=\"{{url}}\">{{label}}</a>{{/nav}}{{#beta}}!{{/beta}}");
+    auto const folded = fold_constants(page, constants, escape_html);
+    CHECK(count_nodes(folded) == 0);
+    CHECK(to_string(folded(object{})) == "<title>&lt;Site&gt;</title><a href=\"/\">Home</a><a href=\"/about\">About</a>!");
+
+    // Only the request data is needed for what's left.
+    format const mixed("{{site}}: {{#user}}{{name}}{{/user}}{{#nav}} {{label}}{{/nav}}");
+    CHECK(to_string(fold_constants(mixed, constants)(request)) == "<Site>: Ann Home About");
+
+    // A section whose contents see the scope of a constant is kept.
+    format const kept("{{#nav}}{{#user}}{{label}}{{/user}}{{/nav}}");
+    CHECK(fold_constants(kept, constants).doc().ctx.blocks.size() == 2);
+}
+
+TEST_CASE("fold-constants-lambda")
+{
+    int calls = 0;
+    object const constants
+    {
+        {"lazy", lazy_value([&](ast::view const*) -> value { ++calls; return "L"; })},
+        {"name", "N"}
+    };
+    format const fmt("{{lazy}}{{name}}{{#lazy}}x{{/lazy}}");
+    auto const folded = fold_constants(fmt, constants);
+    // Lambdas aren't called, they're called when rendered instead.
+    CHECK(calls == 0);
+    CHECK(to_string(folded(constants)) == "LNx");
+    CHECK(to_string(folded(constants)) == to_string(fmt(constants)));
+}
@@ -0,0 +1,158 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <catch2/catch_test_macros.hpp>
+#include <bustache/render/string.hpp>
+#include "model.hpp"
+
+using namespace bustache;
+using namespace test;
+
+namespace
+{
+    format build(std::string_view tmpl, std::size_t chunk)
+    {
+        format_builder builder;
+        for (std::size_t i = 0; i < tmpl.size(); i += chunk)
+        {
+            // Each chunk is dropped right after it's fed.
+            std::string const piece(tmpl.substr(i, chunk));
+            builder.feed(piece);
+        }
+        return builder.finish();
+    }
+}
+
+TEST_CASE("format-builder")
+{
+    object const data
+    {
+        {"a", "A"},
+        {"b", object{{"c", "C"}}},
+        {"list", array{1, 2, 3}},
+        {"html", "<b>"}
+    };
+    context const partials
+    {
+        {"p", "[{{a}}]\n"_fmt},
+        {"layout", "<{{$body}}default{{/body}}>"_fmt}
+    };
+
+    char const* const tmpls[] =
+    {
+        "",
+        "plain text only",
+        "{{a}}",
+        "Hello {{a}} and {{{html}}} and {{&html}}!",
+        "{{#b}}\n  {{c}}\n{{/b}}\n",
+        "  {{#list}}\n  - {{.}}\n  {{/list}}\n",
+        "{{^missing}}none{{/missing}}",
+        "{{! a comment {{ with }} tags }}after",
+        "{{=<% %>=}}<%a%> {{a}} <%={{ }}=%>{{a}}",
+        "{{=<<< >>>=}}x<<<a>>>y\n<<<={{ }}=>>>",
+        "line\n  {{>p}}\nend",
+        "{{<layout}}\n{{$body}}override {{a}}{{/body}}\n{{/layout}}",
+        "{{b.c}} {{list:*^3}}",
+        "{{#list}}{{.}},{{/list}}\r\n{{/}}ignored"
+    };
+
+    for (auto const tmpl : tmpls)
+    {
+        auto const expected = to_string(format(tmpl)(data).context(partials).escape(escape_html));
+        for (std::size_t chunk = 1; chunk != 12; ++chunk)
+            CHECK(to_string(build(tmpl, chunk)(data).context(partials).escape(escape_html)) == expected);
+    }
+}
+
+TEST_CASE("format-builder-long-input")
+{
+    std::string tmpl;
+    for (int i = 0; i != 2000; ++i)
+        tmpl += "<li>{{a}} " + std::to_string(i) + "</li>\n";
+    object const data{{"a", "x"}};
+    auto const expected = to_string(format(tmpl)(data));
+    CHECK(to_string(build(tmpl, 7)(data)) == expected);
+    CHECK(to_string(build(tmpl, 4096)(data)) == expected);
+
+    // The result owns its text and can be copied.
+    auto const fmt = build(tmpl, 13);
+    format const copy(fmt);
+    CHECK(to_string(copy(data)) == expected);
+}
+
+TEST_CASE("format-builder-long-line")
+{
+    // A single line with no tag, e.g. minified HTML, isn't held until its end.
+    std::string tmpl(1 << 20, 'x');
+    for (std::size_t i = 0; i < tmpl.size(); i += 1000)
+        tmpl[i] = '{';
+    auto const fmt = build(tmpl, 1);
+    CHECK(to_string(fmt(nullptr)) == tmpl);
+
+    // And with a tag at its end, split across the chunks.
+    tmpl += "{{a}}";
+    object const data{{"a", "y"}};
+    CHECK(to_string(build(tmpl, 1)(data)) == tmpl.substr(0, tmpl.size() - 5) + "y");
+}
+
+TEST_CASE("format-builder-errors")
+{
+    auto const position = [](std::string_view tmpl, std::size_t chunk)
+    {
+        try
+        {
+            build(tmpl, chunk);
+        }
+        catch (format_error const& e)
+        {
+            return e.position();
+        }
+        return std::ptrdiff_t(-1);
+    };
+
+    char const* const tmpls[] =
+    {
+        "some text {{#a}} {{/b}} more text after the error",
+        "{{a",
+        "{{!unterminated",
+        "abc\ndef {{=<% %>}}",
+        "{{:a}} and the rest"
+    };
+
+    for (auto const tmpl : tmpls)
+    {
+        std::ptrdiff_t expected = -1;
+        CHECK_THROWS_AS(format(tmpl), format_error);
+        try
+        {
+            format{tmpl};
+        }
+        catch (format_error const& e)
+        {
+            expected = e.position();
+        }
+        for (std::size_t chunk = 1; chunk != 8; ++chunk)
+            CHECK(position(tmpl, chunk) == expected);
+    }
+
+    // Errors are reported as soon as they're certain.
+    format_builder builder;
+    CHECK_THROWS_AS(builder.feed("{{#a}}{{/b}}  and then some more text"), format_error);
+}
+
+TEST_CASE("format-builder-reuse")
+{
+    format_builder builder;
+    builder.feed("{{a}}");
+    builder.feed("1");
+    auto const first = builder.finish();
+    builder.feed("2{{a}}");
+    auto const second = builder.finish();
+    object const data{{"a", "A"}};
+    CHECK(to_string(first(data)) == "A1");
+    CHECK(to_string(second(data)) == "2A");
+    CHECK(to_string(builder.finish()(data)) == "");
+}
@@ -0,0 +1,185 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <catch2/catch_test_macros.hpp>
+#include <bustache/render/string.hpp>
+#include <random>
+#include "model.hpp"
+
+using namespace bustache;
+using namespace test;
+
+namespace
+{
+    object const data
+    {
+        {"a", "A"},
+        {"b", object{{"c", "C"}}},
+        {"list", array{1, 2, 3}},
+        {"html", "<b>"}
+    };
+
+    context const partials
+    {
+        {"p", "[{{a}}]\n"_fmt},
+        {"layout", "<{{$body}}default{{/body}}>"_fmt}
+    };
+
+    std::string render(format const& fmt)
+    {
+        return to_string(fmt(data).context(partials).escape(escape_html));
+    }
+
+    std::string apply(std::string s, source_edit const& e)
+    {
+        return s.replace(e.offset, e.length, e.text);
+    }
+
+    std::ptrdiff_t error_position(std::string_view tmpl)
+    {
+        try
+        {
+            format{tmpl};
+        }
+        catch (format_error const& e)
+        {
+            return e.position();
+        }
+        return -1;
+    }
+}
+
+TEST_CASE("format-edit")
+{
+    std::string src =
+        "Hello {{a}}!\n"
+        "{{#b}}\n"
+        "  {{c}}\n"
+        "{{/b}}\n"
+        "{{#list}}{{.}},{{/list}}\n"
+        "  {{>p}}\n"
+        "bye\n";
+    format fmt(src, editable);
+    CHECK(fmt.source() == src);
+    CHECK(render(fmt) == render(format(src)));
+
+    auto const check = [&](source_edit const& e)
+    {
+        src = apply(src, e);
+        fmt.edit(e);
+        CHECK(fmt.source() == src);
+        CHECK(render(fmt) == render(format(src)));
+    };
+    // Replace a variable.
+    check({src.find("{{a}}"), 5, "{{{html}}}"});
+    // Change the meaning of the rest, and back.
+    check({0, 0, "{{=<% %>=}}\n"});
+    check({0, 12, ""});
+    // Indent a standalone tag.
+    check({src.find("{{#b}}"), 0, "  "});
+    // Rewrite an open tag.
+    check({src.find("{{#b}}"), 6, "{{^b}}"});
+    // Append, then delete the last line.
+    check({src.size(), 0, "{{a}}"});
+    check({src.rfind("bye"), src.size() - src.rfind("bye"), ""});
+}
+
+TEST_CASE("format-edit-reuse")
+{
+    std::string src;
+    for (int i = 0; i != 100; ++i)
+        src += "<li>{{a}} " + std::to_string(i) + "</li>\n";
+    format fmt(src, editable);
+    auto const variables = fmt.doc().ctx.variables.size();
+    auto const texts = fmt.doc().ctx.texts.size();
+
+    // Only the edited line is parsed again.
+    auto const pos = src.find("{{a}} 50");
+    fmt.edit({pos, 5, "{{&a}}"});
+    src.replace(pos, 5, "{{&a}}");
+    CHECK(render(fmt) == render(format(src)));
+    CHECK(fmt.doc().ctx.variables.size() == variables + 1);
+    CHECK(fmt.doc().ctx.texts.size() <= texts + 2);
+
+    // Copies are not affected.
+    format const copy(fmt);
+    fmt.edit({0, src.size(), "x"});
+    CHECK(render(fmt) == "x");
+    CHECK(render(copy) == render(format(src)));
+}
+
+TEST_CASE("format-edit-errors")
+{
+    std::string const src = "{{#a}}x{{/a}} {{b}}";
+    format fmt(src, editable);
+    auto const expected = render(fmt);
+
+    CHECK_THROWS_AS(fmt.edit({10, 1, "b"}), format_error);
+    CHECK(fmt.source() == src);
+    CHECK(render(fmt) == expected);
+    CHECK_THROWS_AS(fmt.edit({src.size(), 1, ""}), std::out_of_range);
+
+    format plain(src);
+    CHECK(plain.source().empty());
+    CHECK_THROWS_AS(plain.edit({0, 0, "x"}), std::logic_error);
+}
+
+TEST_CASE("format-edit-random")
+{
+    char const* const pieces[] =
+    {
+        "x", " ", "\n", "  ", "{{a}}", "{{{html}}}", "{{#b}}", "{{/b}}",
+        "{{^b}}", "{{c}}", "{{#list}}", "{{/list}}", "{{.}}", "{{! c }}",
+        "{{>p}}", "{{=<% %>=}}", "<%={{ }}=%>", "<%a%>", "{{<layout}}",
+        "{{/layout}}", "{{$body}}", "{{/body}}", "{{/}}", "{{", "}}"
+    };
+    std::mt19937 rng(42);
+    auto const pick = [&](std::size_t n) { return std::uniform_int_distribution<std::size_t>(0, n)(rng); };
+    auto const piece = [&] { return std::string(pieces[pick(std::size(pieces) - 1)]); };
+
+    for (int round = 0; round != 40; ++round)
+    {
+        std::string src;
+        while (error_position(src) == -1 && src.size() < 200)
+        {
+            auto const next = src + piece();
+            if (error_position(next) != -1)
+                break;
+            src = next;
+        }
+        format fmt(src, editable);
+        for (int n = 0; n != 50; ++n)
+        {
+            auto const offset = pick(src.size());
+            auto const length = pick(std::min<std::size_t>(src.size() - offset, 12));
+            std::string text;
+            for (auto k = pick(2); k; --k)
+                text += piece();
+            source_edit const e{offset, length, text};
+            auto const next = apply(src, e);
+            if (auto const pos = error_position(next); pos != -1)
+            {
+                std::ptrdiff_t actual = -1;
+                try
+                {
+                    fmt.edit(e);
+                }
+                catch (format_error const& err)
+                {
+                    actual = err.position();
+                }
+                CHECK(actual == pos);
+                CHECK(fmt.source() == src);
+            }
+            else
+            {
+                fmt.edit(e);
+                src = next;
+            }
+            REQUIRE(render(fmt) == render(format(src)));
+        }
+    }
+}
@@ -0,0 +1,176 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <thread>
+#include <catch2/catch_test_macros.hpp>
+#include <bustache/render/string.hpp>
+#include <bustache/fragment_cache.hpp>
+#include "model.hpp"
+
+using namespace bustache;
+using namespace test;
+
+namespace
+{
+    template<class Escape = no_escape_t>
+    std::string render_cached(format const& fmt, object const& data, fragment_cache& cache, context const& partials = {}, Escape escape = {}, render_engine engine = render_engine::tree)
+    {
+        std::string ret;
+        render_string(ret, fmt(data).context(partials).escape(escape).engine(engine).fragments(cache));
+        return ret;
+    }
+}
+
+TEST_CASE("fragment-cache")
+{
+    lru_fragment_cache cache(1024);
+    format const fmt("[{{@version}}<{{name}}>{{/version}}]");
+
+    CHECK(render_cached(fmt, {{"version", 1}, {"name", "a"}}, cache) == "[<a>]");
+    CHECK(cache.misses() == 1);
+    CHECK(cache.hits() == 0);
+    // The same key, the output kept is written.
+    CHECK(render_cached(fmt, {{"version", 1}, {"name", "b"}}, cache) == "[<a>]");
+    CHECK(cache.hits() == 1);
+    // Another key.
+    CHECK(render_cached(fmt, {{"version", 2}, {"name", "b"}}, cache) == "[<b>]");
+    CHECK(cache.misses() == 2);
+    // Not cached without a key.
+    CHECK(render_cached(fmt, {{"name", "c"}}, cache) == "[<c>]");
+    CHECK(cache.hits() + cache.misses() == 3);
+    // Not cached without a cache either.
+    CHECK(to_string(fmt(object{{"version", 1}, {"name", "d"}})) == "[<d>]");
+    CHECK(to_string(fmt(object{{"version", 1}, {"name", "d"}}).fragments(cache)) == "[<a>]");
+
+    // The contents are part of the identity.
+    format const other("[{{@version}}({{name}}){{/version}}]");
+    CHECK(render_cached(other, {{"version", 1}, {"name", "e"}}, cache) == "[(e)]");
+    CHECK(cache.misses() == 3);
+
+    // The escaped output is kept as written.
+    format const escaped("{{@version}}{{html}}{{{html}}}{{/version}}");
+    CHECK(render_cached(escaped, {{"version", 1}, {"html", "<b>"}}, cache, {}, escape_html) == "&lt;b&gt;<b>");
+    CHECK(render_cached(escaped, {{"version", 1}, {"html", "<i>"}}, cache, {}, escape_html) == "&lt;b&gt;<b>");
+
+    // The escape action isn't part of the identity, so use a cache for each.
+    lru_fragment_cache raw(1024);
+    CHECK(render_cached(escaped, {{"version", 1}, {"html", "<i>"}}, raw) == "<i><i>");
+    CHECK(render_cached(escaped, {{"version", 1}, {"html", "<b>"}}, cache, {}, escape_html) == "&lt;b&gt;<b>");
+
+    cache.clear();
+    CHECK(cache.size() == 0);
+    CHECK(render_cached(fmt, {{"version", 1}, {"name", "f"}}, cache) == "[<f>]");
+}
+
+TEST_CASE("fragment-cache-keys")
+{
+    lru_fragment_cache cache(1024);
+    format const fmt("{{@user}}<{{user.name}}{{name}}>{{/user}}");
+    // Objects print nothing, they aren't cached.
+    CHECK(render_cached(fmt, {{"user", object{{"name", "a"}}}}, cache) == "<a>");
+    CHECK(render_cached(fmt, {{"user", object{{"name", "b"}}}}, cache) == "<b>");
+    // Neither are lists, lambdas, nor empty strings.
+    CHECK(render_cached(fmt, {{"user", array{1}}, {"name", "c"}}, cache) == "<c>");
+    CHECK(render_cached(fmt, {{"user", lazy_value([](ast::view const*) -> value { return 1; })}, {"name", "d"}}, cache) == "<d>");
+    CHECK(render_cached(fmt, {{"user", ""}, {"name", "e"}}, cache) == "<e>");
+    CHECK(render_cached(fmt, {{"user", ""}, {"name", "f"}}, cache) == "<f>");
+    CHECK(cache.hits() + cache.misses() == 0);
+    // Atoms are.
+    CHECK(render_cached(fmt, {{"user", 1}, {"name", "g"}}, cache) == "<g>");
+    CHECK(render_cached(fmt, {{"user", 1}, {"name", "h"}}, cache) == "<g>");
+    CHECK(cache.hits() == 1);
+}
+
+TEST_CASE("fragment-cache-nested")
+{
+    lru_fragment_cache cache(1024);
+    context const partials{{"tile", "{{@id}}<{{name}}>{{/id}}"_fmt}};
+    format const fmt("{{@page}}{{#items}}{{>tile}}{{/items}}{{/page}}|{{#items}}{{>tile}}{{/items}}");
+    object const data{{"page", "p1"}, {"items", array{object{{"id", 1}, {"name", "a"}}, object{{"id", 2}, {"name", "b"}}}}};
+    object const changed{{"page", "p1"}, {"items", array{object{{"id", 1}, {"name", "x"}}, object{{"id", 3}, {"name", "c"}}}}};
+    for (auto const engine : {render_engine::tree, render_engine::bytecode})
+    {
+        cache.clear();
+        CHECK(render_cached(fmt, data, cache, partials, no_escape, engine) == "<a><b>|<a><b>");
+        // The page is kept with the tiles inside.
+        CHECK(render_cached(fmt, changed, cache, partials, no_escape, engine) == "<a><b>|<a><c>");
+    }
+
+    // The output of an indented one depends on where it's rendered.
+    auto const misses = cache.misses();
+    format const indented("  {{>tile}}\n");
+    CHECK(render_cached(indented, {{"id", 1}, {"name", "y"}}, cache, partials) == "  <y>");
+    CHECK(cache.misses() == misses);
+}
+
+TEST_CASE("fragment-cache-overrides")
+{
+    lru_fragment_cache cache(1024);
+    context const partials{{"layout", "{{@v}}<{{$title}}d{{/title}}>{{/v}}"_fmt}};
+    format const a("{{<layout}}{{$title}}A{{/title}}{{/layout}}");
+    format const b("{{<layout}}{{$title}}B{{/title}}{{/layout}}");
+    format const plain("{{>layout}}");
+    object const data{{"v", 1}};
+    for (auto const engine : {render_engine::tree, render_engine::bytecode})
+    {
+        cache.clear();
+        // The overriders in effect are part of the identity.
+        CHECK(render_cached(a, data, cache, partials, no_escape, engine) == "<A>");
+        CHECK(render_cached(b, data, cache, partials, no_escape, engine) == "<B>");
+        CHECK(render_cached(plain, data, cache, partials, no_escape, engine) == "<d>");
+        CHECK(render_cached(a, data, cache, partials, no_escape, engine) == "<A>");
+    }
+    CHECK(cache.hits() == 2);
+}
+
+TEST_CASE("fragment-cache-capacity")
+{
+    lru_fragment_cache cache(10);
+    format const fmt("{{@k}}{{v}}{{/k}}");
+    CHECK(render_cached(fmt, {{"k", "a"}, {"v", "1234"}}, cache) == "1234");
+    CHECK(cache.size() == 5);
+    CHECK(render_cached(fmt, {{"k", "b"}, {"v", "5678"}}, cache) == "5678");
+    CHECK(cache.size() == 10);
+    // The least recently used one is dropped.
+    CHECK(render_cached(fmt, {{"k", "c"}, {"v", "9"}}, cache) == "9");
+    CHECK(cache.size() == 7);
+    CHECK(render_cached(fmt, {{"k", "b"}, {"v", ""}}, cache) == "5678");
+    CHECK(render_cached(fmt, {{"k", "a"}, {"v", "x"}}, cache) == "x");
+    // Too big to keep.
+    CHECK(render_cached(fmt, {{"k", "d"}, {"v", "0123456789"}}, cache) == "0123456789");
+    CHECK(cache.size() <= cache.capacity());
+    CHECK(render_cached(fmt, {{"k", "d"}, {"v", "y"}}, cache) == "y");
+}
+
+TEST_CASE("fragment-cache-threads")
+{
+    lru_fragment_cache cache(1 << 16);
+    format const fmt("{{#items}}{{@.}}<{{.}}>{{/.}}{{/items}}");
+    array items;
+    std::string expected;
+    for (int i = 0; i != 50; ++i)
+    {
+        items.push_back(i % 10);
+        expected += "<" + std::to_string(i % 10) + ">";
+    }
+    object const data{{"items", items}};
+    std::vector<std::thread> threads;
+    std::vector<std::string> results(4);
+    for (auto& r : results)
+    {
+        threads.emplace_back([&]
+        {
+            for (int i = 0; i != 20; ++i)
+                r = render_cached(fmt, data, cache);
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    for (auto const& r : results)
+        CHECK(r == expected);
+    CHECK(cache.hits() + cache.misses() == 4 * 20 * 50);
+    CHECK(cache.misses() >= 10);
+}
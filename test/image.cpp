@@ -0,0 +1,119 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <cstring>
+#include <catch2/catch_test_macros.hpp>
+#include <bustache/image.hpp>
+#include <bustache/render/string.hpp>
+#include "model.hpp"
+
+using namespace bustache;
+using namespace test;
+
+namespace
+{
+    object const data
+    {
+        {"a", "A"},
+        {"b", object{{"c", "C"}}},
+        {"list", array{1, 2, 3}},
+        {"html", "<b>"},
+        {"n", 42}
+    };
+
+    context const partials
+    {
+        {"p", "[{{a}}]\n"_fmt},
+        {"layout", "<{{$body}}default{{/body}}>"_fmt}
+    };
+
+    std::string render(format const& fmt)
+    {
+        return to_string(fmt(data).context(partials).escape(escape_html));
+    }
+
+    char const* const tmpls[] =
+    {
+        "",
+        "plain text only",
+        "Hello {{a}} and {{{html}}} and {{&html}}!",
+        "{{#b}}\n  {{c}}\n{{/b}}\n",
+        "  {{#list}}\n  - {{.}}\n  {{/list}}\n",
+        "{{^missing}}none{{/missing}}",
+        "{{=<% %>=}}<%a%> {{a}} <%={{ }}=%>{{a}}",
+        "line\n  {{>p}}\nend",
+        "{{<layout}}\n{{$body}}override {{a}}{{/body}}\n{{/layout}}",
+        "{{b.c}} {{#b}}{{.c}}{{/b}} {{n:>5}}|{{a}}",
+        "{{#list}}{{.}},{{/list}}\r\n{{/}}ignored"
+    };
+}
+
+TEST_CASE("image-roundtrip")
+{
+    for (auto const tmpl : tmpls)
+    {
+        format const fmt(tmpl);
+        auto const expected = render(fmt);
+        auto const image = save_image(fmt);
+        CHECK(render(load_image(image, false)) == expected);
+
+        // Texts are copied, the image can go away.
+        auto image_copy = image;
+        auto const loaded = load_image(image_copy, true);
+        image_copy.assign(image_copy.size(), '\0');
+        CHECK(render(loaded) == expected);
+
+        // Loading doesn't depend on the address or alignment of the image.
+        std::string const shifted = "x" + image;
+        CHECK(render(load_image(std::string_view(shifted).substr(1), false)) == expected);
+
+        CHECK(save_image(load_image(image, false)) == image);
+    }
+}
+
+TEST_CASE("image-errors")
+{
+    auto const image = save_image("{{#b}}{{c}}{{/b}}{{>p}}{{<layout}}{{$body}}{{a.b}}{{/body}}{{/layout}}"_fmt);
+    CHECK_THROWS_AS(load_image({}, false), image_error);
+    CHECK_THROWS_AS(load_image(std::string_view(image).substr(0, image.size() - 1), false), image_error);
+    CHECK_THROWS_AS(load_image(image + "x", false), image_error);
+
+    auto bad = image;
+    bad[0] = 'X';
+    CHECK_THROWS_WITH(load_image(bad, false), "bustache image: bad magic");
+    bad = image;
+    ++bad[4];
+    CHECK_THROWS_WITH(load_image(bad, false), "bustache image: unsupported version");
+
+    // An empty text.
+    {
+        auto const text = save_image("x\ny"_fmt);
+        std::uint32_t contents;
+        std::memcpy(&contents, text.data() + 12, sizeof(contents));
+        bad = text;
+        // The size of the first text entry, after the header and the contents.
+        std::memset(bad.data() + 56 + contents * 8 + 4, 0, 4);
+        CHECK_THROWS_WITH(load_image(bad, false), "bustache image: corrupted");
+    }
+
+    // Whatever byte is damaged, the image is either rejected or loads into
+    // something that renders safely.
+    for (std::size_t i = 0; i != image.size(); ++i)
+    {
+        for (char const c : {'\x01', '\x80', '\xff'})
+        {
+            bad = image;
+            bad[i] = static_cast<char>(bad[i] ^ c);
+            try
+            {
+                render(load_image(bad, false));
+            }
+            catch (std::exception const&)
+            {
+            }
+        }
+    }
+}
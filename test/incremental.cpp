@@ -0,0 +1,142 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <stdexcept>
+#include <catch2/catch_test_macros.hpp>
+#include <bustache/render/incremental.hpp>
+#include "model.hpp"
+
+using namespace bustache;
+using namespace test;
+
+namespace
+{
+    std::string patched(std::string s, std::vector<output_patch> const& patches)
+    {
+        for (auto it = patches.rbegin(); it != patches.rend(); ++it)
+            s.replace(it->offset, it->size, it->text);
+        return s;
+    }
+
+    value& at(object& obj, std::string_view key)
+    {
+        return std::find_if(obj.begin(), obj.end(), [&](auto const& kv) { return kv.first == key; })->second;
+    }
+}
+
+TEST_CASE("incremental-render")
+{
+    int clock_calls = 0;
+    object data
+    {
+        {"title", "Status"},
+        {"items", array{object{{"name", "a"}}, object{{"name", "b"}}}},
+        {"stats", object{{"cpu", 10}, {"mem", 20}}},
+        {"clock", lazy_value([&](ast::view const*) -> value { ++clock_calls; return "T"; })},
+        {"flag", true}
+    };
+    format const fmt("<h1>{{title}}</h1>\n{{#items}}<li>{{name}}</li>{{/items}}\ncpu={{stats.cpu}} {{#stats}}mem={{mem}}{{/stats}} {{clock}}\n{{^flag}}off{{/flag}}");
+    incremental_render r(fmt);
+    auto const first = r.render(data, no_context, escape_html);
+    CHECK(first == to_string(fmt(data).escape(escape_html)));
+    CHECK(clock_calls == 2);
+
+    auto const check = [&](std::initializer_list<std::string_view> names)
+    {
+        auto const old = r.output();
+        std::vector<std::string_view> const changed(names);
+        auto const patches = r.update(data, changed, no_context, escape_html);
+        CHECK(r.output() == to_string(fmt(data).escape(escape_html)));
+        CHECK(patched(old, patches) == r.output());
+        return patches;
+    };
+
+    // Only the title is rendered again.
+    at(data, "title") = "<New>";
+    auto patches = check({"title"});
+    REQUIRE(patches.size() == 1);
+    CHECK(patches[0].offset == 4);
+    CHECK(patches[0].text == "&lt;New&gt;");
+    CHECK(clock_calls == 3);
+
+    // A member of a list.
+    std::get<object>(std::get<array>(at(data, "items"))[1])[0].second = "c";
+    patches = check({"items"});
+    REQUIRE(patches.size() == 1);
+    CHECK(patches[0].text == "<li>a</li><li>c</li>");
+
+    // A member changes those looking up its parent or itself.
+    std::get<object>(at(data, "stats"))[0].second = 11;
+    std::get<object>(at(data, "stats"))[1].second = 21;
+    patches = check({"stats.cpu", "stats.mem"});
+    CHECK(patches.size() == 2);
+
+    // A parent changes those looking up its members.
+    at(data, "stats") = object{{"cpu", 1}, {"mem", 2}};
+    check({"stats"});
+
+    // The unchanged ones give no patch.
+    at(data, "flag") = false;
+    patches = check({"flag", "missing"});
+    REQUIRE(patches.size() == 1);
+    CHECK(patches[0].text == "off");
+    CHECK(check({"unknown"}).empty());
+
+    // Lambdas are called when their names change.
+    auto const calls = clock_calls;
+    check({"clock"});
+    CHECK(clock_calls > calls);
+}
+
+TEST_CASE("incremental-render-implicit")
+{
+    array data{1, 2};
+    format const fmt("a{{#.}}{{.}}{{/.}}b");
+    incremental_render r(fmt);
+    std::vector<std::string_view> const changed{"x"};
+    // Not rendered yet, it's all changed.
+    auto patches = r.update(data, changed);
+    REQUIRE(patches.size() == 1);
+    CHECK(patches[0].text == "a12b");
+    data.push_back(3);
+    // The data itself is looked up.
+    patches = r.update(data, changed);
+    REQUIRE(patches.size() == 1);
+    CHECK(r.output() == "a123b");
+}
+
+TEST_CASE("incremental-render-throw")
+{
+    bool fail = false;
+    object data
+    {
+        {"a", "1"},
+        {"b", lazy_value([&](ast::view const*) -> value
+        {
+            if (fail)
+                throw std::runtime_error("fail");
+            return "2";
+        })},
+        {"c", "3"}
+    };
+    format const fmt("<{{a}}>{{b}}<{{c}}>");
+    incremental_render r(fmt);
+    CHECK(r.render(data) == "<1>2<3>");
+    std::vector<std::string_view> const changed{"a", "b", "c"};
+    at(data, "a") = "long";
+    fail = true;
+    CHECK_THROWS_AS(r.update(data, changed), std::runtime_error);
+    // The output stays as before.
+    CHECK(r.output() == "<1>2<3>");
+    fail = false;
+    at(data, "c") = "x";
+    auto const patches = r.update(data, changed);
+    CHECK(r.output() == "<long>2<x>");
+    CHECK(patched("<1>2<3>", patches) == r.output());
+    std::vector<std::string_view> const c{"c"};
+    at(data, "c") = "y";
+    CHECK(patched("<long>2<x>", r.update(data, c)) == "<long>2<y>");
+}
@@ -109,4 +109,39 @@ TEST_CASE("inheritance")
     // Text inside super
     CHECK(to_string("{{<include}} asdfasd asdfasdfasdf {{/include}}"_fmt(nullptr)
         .context(context{{"include", "{{$foo}}default content{{/foo}}"_fmt}})) == "default content");
-}
\ No newline at end of file
+}
+
+TEST_CASE("inheritance-override-table")
+{
+    context const layouts
+    {
+        {"base", "[{{$head}}h{{/head}}|{{$body}}b{{/body}}|{{$foot}}f{{/foot}}]"_fmt},
+        {"page", "{{<base}}{{$body}}page {{$title}}t{{/title}}{{/body}}{{$foot}}pf{{/foot}}{{/base}}"_fmt},
+        {"article", "{{<page}}{{$title}}article{{/title}}{{$foot}}af{{/foot}}{{/page}}"_fmt}
+    };
+
+    // The outermost override wins at any depth.
+    CHECK(to_string("{{<article}}{{$head}}H{{/head}}{{/article}}"_fmt(nullptr).context(layouts))
+        == "[H|page article|af]");
+
+    // The overrides end with the partial.
+    CHECK(to_string("{{<page}}{{$title}}T{{/title}}{{/page}}{{<base}}{{/base}}"_fmt(nullptr).context(layouts))
+        == "[h|page T|pf][h|b|f]");
+
+    // The first overrider of a name wins.
+    format const twice("{{<base}}{{$head}}1{{/head}}{{$head}}2{{/head}}{{/base}}");
+    CHECK(to_string(twice(nullptr).context(layouts)) == "[1|b|f]");
+
+    // The overriders are sorted by name.
+    format const fmt("{{<base}}{{$foot}}F{{/foot}}{{$body}}B{{/body}}{{/base}}");
+    auto const& ctx = fmt.doc().ctx;
+    REQUIRE(ctx.overriders.size() == 1);
+    auto const& map = ctx.overriders[0];
+    REQUIRE(map.size() == 2);
+    CHECK(ctx.key(map[0].key) == "body");
+    CHECK(ctx.key(map[1].key) == "foot");
+    auto const o = ctx.find_overrider(map, "foot");
+    REQUIRE(o);
+    CHECK(o == &map[1]);
+    CHECK(!ctx.find_overrider(map, "head"));
+}
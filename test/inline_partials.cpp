@@ -0,0 +1,158 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <catch2/catch_test_macros.hpp>
+#include <bustache/render/string.hpp>
+#include "model.hpp"
+
+using namespace bustache;
+using namespace test;
+
+namespace
+{
+    std::size_t count_partials(format const& fmt)
+    {
+        return fmt.doc().ctx.partials.size();
+    }
+}
+
+TEST_CASE("inline-partials-indent")
+{
+    context const partials
+    {
+        {"line", "<{{name}}>"_fmt},
+        {"lines", "a\nb{{name}}\n{{name}}c\n"_fmt},
+        {"nested", "x\n  {{>lines}}\ny"_fmt},
+        {"list", "{{#list}}\n- {{.}}\n{{/list}}\n"_fmt},
+        {"empty", ""_fmt}
+    };
+    object const data{{"name", "N"}, {"list", array{1, 2}}};
+    char const* const sources[] =
+    {
+        "{{>line}}",
+        "|{{>line}}|\n",
+        "  {{>line}}\n",
+        "  {{>lines}}\nz\n",
+        "\t{{>nested}}\n",
+        "> {{>lines}}\n> {{>lines}}",
+        "  {{>list}}\n",
+        "  {{>empty}}\nz",
+        "{{#list}}\n  {{>lines}}\n{{/list}}"
+    };
+    for (auto const source : sources)
+    {
+        INFO(source);
+        format const fmt(source);
+        auto const inlined = inline_partials(fmt, partials);
+        CHECK(to_string(inlined(data)) == to_string(fmt(data).context(partials)));
+        CHECK(count_partials(inlined) == 0);
+    }
+}
+
+TEST_CASE("inline-partials-kept")
+{
+    context const partials
+    {
+        {"item", "[{{name}}]"_fmt},
+        {"parent", "<{{$body}}d{{/body}}>"_fmt},
+        {"self", "{{#next}}({{>self}}){{/next}}"_fmt},
+        // Whether `name` starts a line depends on `flag`.
+        {"maybe", "{{#flag}}x{{/flag}}{{name}}\n"_fmt}
+    };
+    object const data
+    {
+        {"name", "item"},
+        {"next", object{{"next", object{{"next", false}}}}},
+        {"flag", true}
+    };
+    struct
+    {
+        char const* source;
+        std::size_t partials;
+    } const cases[] =
+    {
+        {"{{>*name}}", 1},
+        // An override from outside couldn't be indented, nor can the one in
+        // the overrider then.
+        {"  {{<parent}}\n{{$body}}{{>item}}{{/body}}\n{{/parent}}\n", 2},
+        {"{{>self}}", 1},
+        {"{{>missing}}", 1},
+        {"  {{>maybe}}\n", 1}
+    };
+    for (auto const& c : cases)
+    {
+        INFO(c.source);
+        format const fmt(c.source);
+        auto const inlined = inline_partials(fmt, partials);
+        CHECK(to_string(inlined(data).context(partials)) == to_string(fmt(data).context(partials)));
+        CHECK(count_partials(inlined) == c.partials);
+    }
+}
+
+TEST_CASE("inline-partials-own-text")
+{
+    format inlined;
+    {
+        std::string const source = "[{{.}}]";
+        context const partials{{"item", format(source, false)}};
+        inlined = inline_partials(format("{{#list}}{{>item}}{{/list}}"), partials);
+    }
+    CHECK(to_string(inlined(object{{"list", array{1, 2}}})) == "[1][2]");
+}
+
+TEST_CASE("inline-partials-inheritance")
+{
+    context const partials
+    {
+        {"base", "<title>{{$title}}Site{{/title}}</title>\n{{>header}}{{$body}}{{/body}}\n"_fmt},
+        {"header", "<h1>{{$title}}{{/title}}</h1>\n"_fmt},
+        {"page", "{{<base}}{{$body}}{{$content}}-{{/content}}{{/body}}{{/base}}"_fmt},
+        {"item", "[{{name}}]"_fmt}
+    };
+    object const data{{"name", "N"}, {"dyn", "item"}};
+    char const* const sources[] =
+    {
+        "{{<base}}{{$title}}T {{name}}{{/title}}{{/base}}",
+        "{{<page}}{{$title}}T{{/title}}{{$content}}{{>item}}{{/content}}{{/page}}",
+        "{{<page}}{{$content}}{{>*dyn}}{{/content}}{{/page}}",
+        "{{<missing}}{{$title}}T{{/title}}{{/missing}}"
+    };
+    for (auto const source : sources)
+    {
+        INFO(source);
+        format const fmt(source);
+        auto const expected = to_string(fmt(data).context(partials));
+        auto const inlined = inline_partials(fmt, partials);
+        CHECK(to_string(inlined(data).context(partials)) == expected);
+        auto const resolved = resolve_inheritance(fmt, partials);
+        CHECK(to_string(resolved(data).context(partials)) == expected);
+    }
+
+    // Only the plain partials are kept, with the overrides in effect.
+    format const fmt("{{<page}}{{$title}}T{{/title}}{{$content}}{{>item}}{{/content}}{{/page}}");
+    auto const resolved = resolve_inheritance(fmt, partials);
+    auto const& ctx = resolved.doc().ctx;
+    CHECK(count_partials(resolved));
+    for (auto const& p : ctx.partials)
+    {
+        auto const name = ctx.key(p.key);
+        INFO(name);
+        CHECK((name == "header" || name == "item"));
+        if (name == "header")
+        {
+            REQUIRE(p.overriders != ast::npos);
+            CHECK(ctx.find_overrider(ctx.overriders[p.overriders], "title"));
+        }
+    }
+    CHECK(count_partials(inline_partials(fmt, partials)) == 0);
+
+    // An override from outside of the result still wins.
+    auto all = partials;
+    all.emplace("resolved", resolved);
+    all.emplace("original", fmt);
+    CHECK(to_string("{{<resolved}}{{$title}}O{{/title}}{{/resolved}}"_fmt(data).context(all))
+        == to_string("{{<original}}{{$title}}O{{/title}}{{/original}}"_fmt(data).context(all)));
+}
@@ -0,0 +1,79 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <catch2/catch_test_macros.hpp>
+#include <bustache/render/string.hpp>
+#include "model.hpp"
+
+using namespace bustache;
+using namespace test;
+
+namespace
+{
+    // Counts the lookups made through it.
+    struct counting_context
+    {
+        context const& map;
+        mutable int calls = 0;
+
+        std::optional<std::reference_wrapper<format const>> operator()(std::string_view key) const
+        {
+            ++calls;
+            return map(key);
+        }
+    };
+}
+
+TEST_CASE("link-static-partials")
+{
+    context const partials
+    {
+        {"item", "[{{.}}]"_fmt},
+        {"layout", "<{{$body}}{{/body}}>"_fmt}
+    };
+    object const data{{"list", array{1, 2, 3}}, {"name", "item"}};
+    format fmt("{{#list}}{{>item}}{{/list}}{{<layout}}{{$body}}{{>item}}{{/body}}{{/layout}}{{>missing}}");
+    counting_context counter{partials};
+    auto const expected = to_string(fmt(data).context(counter));
+    CHECK(expected == "[1][2][3]<[]>");
+    // Each name is looked up once a render.
+    CHECK(counter.calls == 3);
+
+    link(fmt, partials);
+    counter.calls = 0;
+    CHECK(to_string(fmt(data).context(counter)) == expected);
+    // Only the one not found is looked up.
+    CHECK(counter.calls == 1);
+
+    // A copy is linked too.
+    format const copy(fmt);
+    counter.calls = 0;
+    CHECK(to_string(copy(data).context(counter)) == expected);
+    CHECK(counter.calls == 1);
+}
+
+TEST_CASE("link-dynamic-partials")
+{
+    context const partials{{"item", "[{{name}}]"_fmt}};
+    object const data{{"name", "item"}};
+    format fmt("{{>*name}}");
+    link(fmt, partials);
+    counting_context counter{partials};
+    CHECK(to_string(fmt(data).context(counter)) == "[item]");
+    CHECK(counter.calls == 1);
+}
+
+TEST_CASE("link-after-edit")
+{
+    context const partials{{"a", "A"_fmt}, {"b", "B"_fmt}};
+    format fmt("{{>a}}|x", editable);
+    link(fmt, partials);
+    fmt.edit({fmt.source().size(), 0, "{{>b}}"});
+    counting_context counter{partials};
+    // New partials are looked up as usual.
+    CHECK(to_string(fmt(nullptr).context(counter)) == "A|xB");
+    CHECK(counter.calls == 1);
+}
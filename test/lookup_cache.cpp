@@ -0,0 +1,150 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <catch2/catch_test_macros.hpp>
+#include <bustache/render/string.hpp>
+#include <vector>
+
+namespace
+{
+    // Counts the calls to `get`.
+    template<bool Fixed>
+    struct item
+    {
+        int v;
+        int* gets;
+    };
+
+    // An object with one key, whose value is an object (as `nested`) or an
+    // int, the misses are counted.
+    struct node
+    {
+        std::string_view key;
+        std::vector<node> nested;
+        int v = 0;
+        int* misses = nullptr;
+    };
+
+    struct root
+    {
+        std::vector<item<true>> fixed;
+        std::vector<item<false>> other;
+        node outer;
+    };
+}
+
+template<bool Fixed>
+struct bustache::impl_model<item<Fixed>>
+{
+    static constexpr model kind = model::object;
+};
+
+template<bool Fixed>
+struct bustache::impl_object<item<Fixed>>
+{
+    static constexpr bool fixed_keys = Fixed;
+
+    static void get(item<Fixed> const& self, std::string_view key, value_handler visit)
+    {
+        ++*self.gets;
+        if (key == "v")
+            return visit(&self.v);
+        return visit(nullptr);
+    }
+};
+
+template<>
+struct bustache::impl_model<node>
+{
+    static constexpr model kind = model::object;
+};
+
+template<>
+struct bustache::impl_object<node>
+{
+    static void get(node const& self, std::string_view key, value_handler visit)
+    {
+        if (key == self.key)
+        {
+            if (self.nested.empty())
+                return visit(&self.v);
+            return visit(&self.nested);
+        }
+        ++*self.misses;
+        return visit(nullptr);
+    }
+};
+
+template<>
+struct bustache::impl_model<root>
+{
+    static constexpr model kind = model::object;
+};
+
+template<>
+struct bustache::impl_object<root>
+{
+    static void get(root const& self, std::string_view key, value_handler visit)
+    {
+        if (key == "fixed")
+            return visit(&self.fixed);
+        if (key == "other")
+            return visit(&self.other);
+        if (key == "outer")
+            return visit(&self.outer.nested);
+        if (key == "r")
+        {
+            static constexpr int r = 0;
+            return visit(&r);
+        }
+        return visit(nullptr);
+    }
+};
+
+using namespace bustache;
+
+TEST_CASE("lookup-cache-fixed-keys")
+{
+    int fixed_gets = 0;
+    int other_gets = 0;
+    root data;
+    for (int i = 0; i != 10; ++i)
+    {
+        data.fixed.push_back({i, &fixed_gets});
+        data.other.push_back({i, &other_gets});
+    }
+    for (auto const engine : {render_engine::tree, render_engine::bytecode})
+    {
+        fixed_gets = other_gets = 0;
+        CHECK(to_string(format("{{#fixed}}{{v}}{{r}}{{/fixed}}")(data).engine(engine)) == "00102030405060708090");
+        // The miss on the first item is remembered for its type.
+        CHECK(fixed_gets == 11);
+        CHECK(to_string(format("{{#other}}{{v}}{{r}}{{/other}}")(data).engine(engine)) == "00102030405060708090");
+        CHECK(other_gets == 20);
+    }
+}
+
+TEST_CASE("lookup-cache-scopes")
+{
+    int misses = 0;
+    root data;
+    data.outer.key = "outer";
+    for (int i = 0; i != 3; ++i)
+    {
+        node& o = data.outer.nested.emplace_back(node{"inner", {}, 0, &misses});
+        for (int j = 0; j != 4; ++j)
+            o.nested.push_back({"v", {}, j, &misses});
+    }
+    for (auto const engine : {render_engine::tree, render_engine::bytecode})
+    {
+        misses = 0;
+        CHECK(to_string(format("{{#outer}}{{#inner}}{{v}}{{r}}{{/inner}};{{/outer}}")(data).engine(engine))
+            == "00102030;00102030;00102030;");
+        // Each item of `inner` misses `r` once, while an item of `outer`
+        // only misses it for the first item of `inner`.
+        CHECK(misses == 3 * 4 + 3);
+    }
+}
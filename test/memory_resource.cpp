@@ -0,0 +1,126 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <catch2/catch_test_macros.hpp>
+#include <bustache/render/string.hpp>
+#include <bustache/image.hpp>
+#include <memory_resource>
+#include "model.hpp"
+
+using namespace bustache;
+using namespace test;
+
+namespace
+{
+    // Counts the bytes in use.
+    struct counting_resource : std::pmr::memory_resource
+    {
+        std::size_t in_use = 0;
+        std::size_t allocations = 0;
+
+        void* do_allocate(std::size_t bytes, std::size_t align) override
+        {
+            in_use += bytes;
+            ++allocations;
+            return std::pmr::new_delete_resource()->allocate(bytes, align);
+        }
+
+        void do_deallocate(void* p, std::size_t bytes, std::size_t align) override
+        {
+            in_use -= bytes;
+            std::pmr::new_delete_resource()->deallocate(p, bytes, align);
+        }
+
+        bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+
+    // Makes the default resource fail while it's set.
+    struct no_default
+    {
+        std::pmr::memory_resource* old = std::pmr::set_default_resource(std::pmr::null_memory_resource());
+
+        ~no_default()
+        {
+            std::pmr::set_default_resource(old);
+        }
+    };
+
+    constexpr std::string_view source =
+        "{{#items}}[{{name}}]{{/items}}"
+        "{{<parent}}{{$block}}child{{/block}}{{/parent}}";
+
+    object const data{{"items", array{object{{"name", "a"}}, object{{"name", "b"}}}}};
+
+    context const partials{{"parent", "<{{$block}}{{/block}}>"_fmt}};
+}
+
+TEST_CASE("memory-resource-format")
+{
+    counting_resource arena;
+    {
+        format fmt(source, true, &arena);
+        CHECK(fmt.resource() == &arena);
+        CHECK(arena.in_use);
+        auto const& ctx = fmt.doc().ctx;
+        REQUIRE(ctx.overriders.size() == 1);
+        CHECK(ctx.overriders[0].get_allocator().resource() == &arena);
+        CHECK(to_string(fmt(data).context(partials)) == "[a][b]<child>");
+
+        // The passes keep the resource.
+        fmt.optimize();
+        CHECK(fmt.resource() == &arena);
+        CHECK(to_string(fmt(data).context(partials)) == "[a][b]<child>");
+
+        // A copy doesn't.
+        format const copy(fmt);
+        CHECK(copy.resource() == std::pmr::get_default_resource());
+        auto const used = arena.in_use;
+        format const moved(std::move(fmt));
+        CHECK(moved.resource() == &arena);
+        CHECK(arena.in_use == used);
+        CHECK(to_string(copy(data).context(partials)) == "[a][b]<child>");
+        CHECK(to_string(moved(data).context(partials)) == "[a][b]<child>");
+    }
+    CHECK(arena.in_use == 0);
+}
+
+TEST_CASE("memory-resource-image")
+{
+    auto const image = save_image(format(source));
+    counting_resource arena;
+    {
+        auto const fmt = load_image(image, true, &arena);
+        CHECK(fmt.resource() == &arena);
+        CHECK(arena.in_use);
+        CHECK(to_string(fmt(data).context(partials)) == "[a][b]<child>");
+    }
+    CHECK(arena.in_use == 0);
+}
+
+TEST_CASE("memory-resource-render")
+{
+    format const fmt("{{#items}}  {{>item}}\n{{/items}}{{missing.x}}");
+    context const item{{"item", "{{name}}\n"_fmt}};
+    counting_resource arena;
+    std::string out;
+    {
+        render_state state(&arena);
+        // The buffers don't come from the default resource.
+        no_default const guard;
+        render_string(out, fmt(data).context(item).state(state));
+        CHECK(out == "  a\n  b\n");
+        CHECK(arena.allocations);
+        auto const allocations = arena.allocations;
+        out.clear();
+        render_string(out, fmt(data).context(item).state(state));
+        CHECK(out == "  a\n  b\n");
+        CHECK(arena.allocations == allocations);
+    }
+    CHECK(arena.in_use == 0);
+}
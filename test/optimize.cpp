@@ -0,0 +1,128 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <catch2/catch_test_macros.hpp>
+#include <bustache/render/string.hpp>
+#include "model.hpp"
+
+using namespace bustache;
+using namespace test;
+
+namespace
+{
+    object const data
+    {
+        {"a", "A"},
+        {"b", object{{"c", "C"}}},
+        {"list", array{1, 2, 3}},
+        {"html", "<b>"},
+        {"n", 42}
+    };
+
+    context const partials
+    {
+        {"p", "[{{a}}]\n{{! x }}\n!"_fmt},
+        {"layout", "<{{$body}}default{{/body}}>\n"_fmt}
+    };
+
+    std::string render(format const& fmt)
+    {
+        return to_string(fmt(data).context(partials).escape(escape_html));
+    }
+
+    char const* const tmpls[] =
+    {
+        "",
+        "plain text only",
+        "a{{! comment }}b{{=<% %>=}}c<%a%>d<%! x %>e",
+        "{{#b}}\n  {{! note }}\n  {{c}}\n{{/b}}\n",
+        "  {{#list}}\n  - {{.}}\n  {{/list}}\n",
+        "{{^missing}}x{{!}}y{{/missing}}{{#a}}{{/a}}|{{^a}}{{#b}}{{/b}}{{/a}}|",
+        "line\n  {{>p}}\n  {{! }}\nend",
+        "{{<layout}}\n{{$body}}x{{! }}y {{a}}{{/body}}\n{{/layout}}",
+        "{{b.c}} {{#b}}{{.c}}{{/b}} {{n:>5}}|{{a}}"
+    };
+}
+
+TEST_CASE("optimize-renders-the-same")
+{
+    for (auto const tmpl : tmpls)
+    {
+        format const fmt(tmpl);
+        auto const expected = render(fmt);
+        CHECK(render(format(tmpl, optimize_options{})) == expected);
+        CHECK(render(format(tmpl, optimize_options{true, true, true})) == expected);
+        CHECK(render(format(tmpl, optimize_options{true, false, false})) == expected);
+    }
+}
+
+TEST_CASE("optimize-coalesce-text")
+{
+    std::string src = "a{{! comment }}b{{=<% %>=}}c";
+    format const fmt(src, optimize_options{});
+    auto const& doc = fmt.doc();
+    REQUIRE(doc.contents.size() == 1);
+    CHECK(doc.ctx.texts.size() == 1);
+    CHECK(doc.ctx.texts[0] == "abc");
+    // The format owns its text.
+    src.assign(src.size(), '\0');
+    CHECK(render(fmt) == "abc");
+}
+
+TEST_CASE("optimize-newline-index")
+{
+    // Without compact, the merged text is only indexed by coalesce_text.
+    format const fmt("a\n{{! x }}b\n\nc\n", optimize_options{false, true, false});
+    auto const& ctx = fmt.doc().ctx;
+    REQUIRE(fmt.doc().contents.size() == 1);
+    auto const i = fmt.doc().contents[0].index;
+    CHECK(ctx.texts[i] == "a\nb\n\nc\n");
+    auto const newlines = ctx.newlines_of(i);
+    CHECK(std::vector<std::uint32_t>(newlines.begin(), newlines.end()) == std::vector<std::uint32_t>{1, 3, 4});
+    context const ps{{"p", fmt}};
+    CHECK(to_string("  {{>p}}\n"_fmt(data).context(ps)) == "  a\n  b\n  \n  c\n");
+
+    // A text added without `add` is scanned until it's indexed.
+    ast::context hand;
+    hand.texts.push_back("x\ny\n");
+    std::vector<std::uint32_t> scanned;
+    hand.for_each_newline(0, [&](std::uint32_t pos) { scanned.push_back(pos); });
+    CHECK(scanned == std::vector<std::uint32_t>{1});
+    hand.index_newlines();
+    auto const indexed = hand.newlines_of(0);
+    CHECK(std::vector<std::uint32_t>(indexed.begin(), indexed.end()) == scanned);
+}
+
+TEST_CASE("optimize-prune-empty")
+{
+    format fmt("{{#a}}{{#b}}{{/b}}{{/a}}{{^c}}{{/c}}{{$d}}{{/d}}x");
+    fmt.optimize({true, true, true});
+    auto const& doc = fmt.doc();
+    // Only the inheritance block and the text are left.
+    REQUIRE(doc.contents.size() == 2);
+    CHECK(doc.contents[0].kind == ast::type::inheritance);
+    CHECK(doc.ctx.blocks.size() == 1);
+    CHECK(doc.ctx.key_ends.size() == 1);
+}
+
+TEST_CASE("optimize-compact")
+{
+    format fmt("{{a}}{{#b}}{{a}}{{/b}}", editable);
+    fmt.edit({0, 5, "{{c.d}}"});
+    fmt.optimize();
+    auto const& ctx = fmt.doc().ctx;
+    CHECK(ctx.variables.size() == 2);
+    // "c", "d", "c.d", "a", "b"
+    CHECK(ctx.key_ends.size() == 5);
+    // No longer editable.
+    CHECK(fmt.source().empty());
+
+    // Optimizing a format that owns its text again.
+    format copied("x{{!}}y", true);
+    copied.optimize();
+    copied.optimize();
+    CHECK(render(copied) == "xy");
+}
@@ -0,0 +1,73 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <benchmark/benchmark.h>
+#include <bustache/format.hpp>
+#include <string>
+#include <vector>
+
+// A corpus shaped like typical page templates: mostly static, indented HTML
+// with a sprinkling of variables, sections, partials and comments.
+static std::vector<std::string> make_corpus()
+{
+    std::vector<std::string> corpus;
+    for (int t = 0; t != 64; ++t)
+    {
+        std::string tmpl;
+        tmpl += "<!DOCTYPE html>\n<html lang=\"{{lang}}\">\n<head>\n";
+        tmpl += "    <meta charset=\"utf-8\">\n    <title>{{title}} - Example</title>\n";
+        tmpl += "    {{> head_assets}}\n</head>\n<body class=\"page page-" + std::to_string(t) + "\">\n";
+        tmpl += "{{! Navigation is rendered from the site config. }}\n";
+        for (int s = 0; s != 4 + t % 5; ++s)
+        {
+            tmpl += "    <section id=\"section-" + std::to_string(s) + "\" class=\"content-block\">\n";
+            tmpl += "        <h2 class=\"content-block__title\">{{ heading }}</h2>\n";
+            tmpl += "        <p class=\"content-block__lead\">Lorem ipsum dolor sit amet, consectetur "
+                    "adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua.</p>\n";
+            tmpl += "        {{#items}}\n";
+            tmpl += "        <div class=\"card\" data-id=\"{{id}}\">\n";
+            tmpl += "            <a href=\"{{{url}}}\">{{item.name}}</a> <span>{{price:.2f}}</span>\n";
+            tmpl += "        </div>\n";
+            tmpl += "        {{/items}}\n";
+            tmpl += "        {{^items}}\n        <p class=\"empty\">Nothing to show here, check back later.</p>\n        {{/items}}\n";
+            tmpl += "    </section>\n";
+        }
+        tmpl += "    {{> footer}}\n</body>\n</html>\n";
+        corpus.push_back(std::move(tmpl));
+    }
+    return corpus;
+}
+
+static void parse_corpus(benchmark::State& state, bustache::parser_kernel kind)
+{
+    auto const old = bustache::get_parser_kernel();
+    if (!bustache::set_parser_kernel(kind))
+    {
+        state.SkipWithError("kernel not supported by this CPU");
+        return;
+    }
+    auto const corpus = make_corpus();
+    std::size_t bytes = 0;
+    for (auto const& tmpl : corpus)
+        bytes += tmpl.size();
+    for (auto _ : state)
+    {
+        for (auto const& tmpl : corpus)
+        {
+            bustache::format fmt(tmpl);
+            benchmark::DoNotOptimize(fmt);
+        }
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * bytes));
+    bustache::set_parser_kernel(old);
+}
+
+BENCHMARK_CAPTURE(parse_corpus, scalar, bustache::parser_kernel::scalar);
+BENCHMARK_CAPTURE(parse_corpus, swar, bustache::parser_kernel::swar);
+BENCHMARK_CAPTURE(parse_corpus, sse42, bustache::parser_kernel::sse42);
+BENCHMARK_CAPTURE(parse_corpus, avx2, bustache::parser_kernel::avx2);
+
+BENCHMARK_MAIN();
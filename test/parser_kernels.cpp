@@ -0,0 +1,87 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <catch2/catch_test_macros.hpp>
+#include <bustache/render/string.hpp>
+#include "model.hpp"
+
+using namespace bustache;
+using namespace test;
+
+namespace
+{
+    constexpr parser_kernel all_kernels[] =
+    {
+        parser_kernel::scalar,
+        parser_kernel::swar,
+        parser_kernel::sse42,
+        parser_kernel::avx2
+    };
+
+    struct kernel_guard
+    {
+        parser_kernel const old = get_parser_kernel();
+        ~kernel_guard() { set_parser_kernel(old); }
+    };
+
+    std::string pad(std::size_t n, char c = 'x')
+    {
+        return std::string(n, c);
+    }
+}
+
+TEST_CASE("parser-kernels")
+{
+    kernel_guard guard;
+    CHECK(get_parser_kernel() != parser_kernel::automatic);
+    CHECK(set_parser_kernel(parser_kernel::scalar));
+    CHECK(get_parser_kernel() == parser_kernel::scalar);
+
+    object const data
+    {
+        {"key", "K"},
+        {"a", object{{"b", "AB"}}},
+        {"list", array{1, 2, 3}}
+    };
+
+    std::vector<std::string> tmpls;
+    for (std::size_t n : {0, 1, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65})
+    {
+        tmpls.push_back(pad(n) + "{{key}}" + pad(n));
+        tmpls.push_back("{{" + pad(n, ' ') + "key" + pad(n, ' ') + "}}");
+        tmpls.push_back("{{{" + pad(n, ' ') + "key" + pad(n, ' ') + "}" + pad(n, ' ') + "}}");
+        tmpls.push_back("{{! " + pad(n) + " {{ " + pad(n) + "}} " + pad(n) + "}}" + pad(n));
+        tmpls.push_back(pad(n) + "\n  {{#list}}\n" + pad(n) + "{{.}}\n  {{/list}}\n" + pad(n));
+        tmpls.push_back("{{=<% %>=}}" + pad(n) + "<%a.b%>" + pad(n) + "<<%key:>4%>");
+        tmpls.push_back(pad(n, '\t') + "{{! comment }}" + pad(n, ' ') + "\n" + pad(n));
+        tmpls.push_back("{{#a}}" + pad(n, '}') + "{ {{b}}{{/a}}");
+    }
+
+    for (auto const& tmpl : tmpls)
+    {
+        set_parser_kernel(parser_kernel::scalar);
+        auto const expected = to_string(format(tmpl)(data));
+        for (auto const k : all_kernels)
+        {
+            if (!set_parser_kernel(k))
+                continue;
+            CHECK(to_string(format(tmpl)(data)) == expected);
+        }
+    }
+}
+
+TEST_CASE("parser-kernels-errors")
+{
+    kernel_guard guard;
+    for (auto const k : all_kernels)
+    {
+        if (!set_parser_kernel(k))
+            continue;
+        CHECK_THROWS_AS(format("{{! " + pad(40) + " {{ " + pad(40)), format_error);
+        CHECK_THROWS_AS(format("{{" + pad(40) + " " + pad(40)), format_error);
+        CHECK_THROWS_AS(format("{{{" + pad(40) + "}" + pad(40) + "}}"), format_error);
+    }
+}
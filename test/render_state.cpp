@@ -0,0 +1,133 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <catch2/catch_test_macros.hpp>
+#include <bustache/render/string.hpp>
+#include <cstdlib>
+#include <new>
+#include "model.hpp"
+
+#if defined(__SANITIZE_ADDRESS__)
+#   define BUSTACHE_TEST_COUNT_ALLOCATIONS 0
+#elif defined(__has_feature)
+#   if __has_feature(address_sanitizer)
+#       define BUSTACHE_TEST_COUNT_ALLOCATIONS 0
+#   endif
+#endif
+#ifndef BUSTACHE_TEST_COUNT_ALLOCATIONS
+#   define BUSTACHE_TEST_COUNT_ALLOCATIONS 1
+#endif
+
+namespace
+{
+    // Stays 0 under AddressSanitizer, which replaces operator new itself.
+    std::size_t allocations = 0;
+}
+
+#if BUSTACHE_TEST_COUNT_ALLOCATIONS
+void* operator new(std::size_t n)
+{
+    ++allocations;
+    if (auto const p = std::malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+#endif
+
+using namespace bustache;
+using namespace test;
+
+namespace
+{
+    object const data
+    {
+        {"title", "T"},
+        {"items", array{object{{"name", "a"}, {"n", 1}}, object{{"name", "b"}, {"n", 2}}}},
+        {"user", object{{"name", "U"}}}
+    };
+
+    context partials
+    {
+        {"item", "- {{name}}: {{n}} ({{title}})\n"_fmt},
+        {"layout", "<{{$body}}{{/body}}>\n{{>footer}}"_fmt},
+        {"footer", "{{#user}}by {{name}}{{/user}}\n"_fmt}
+    };
+
+    // Render to `out` twice, and return the allocations made the second time.
+    std::size_t steady_allocations(std::string& out, format const& fmt, render_engine engine, render_state* state)
+    {
+        auto const manip = fmt(data).context(partials).engine(engine);
+        auto const once = [&]
+        {
+            out.clear();
+            if (state)
+                render_string(out, manip.state(*state));
+            else
+                render_string(out, manip);
+        };
+        once();
+        auto const before = allocations;
+        once();
+        return allocations - before;
+    }
+}
+
+TEST_CASE("render-state-no-allocation")
+{
+    format fmt
+    (
+        "{{title}} {{user.name}}\n"
+        "  {{#items}}\n"
+        "  {{>item}}\n"
+        "  {{/items}}\n"
+        "{{<layout}}{{$body}}{{^missing}}none{{/missing}}{{/body}}{{/layout}}"
+    );
+    // The bytecode of a format not compiled is made during the render.
+    fmt.compile();
+    for (auto& [name, partial] : partials)
+        partial.compile();
+    for (auto const& [engine, name] : {std::pair{render_engine::tree, "tree"}, {render_engine::bytecode, "bytecode"}})
+    {
+        INFO(name);
+        std::string out;
+        out.reserve(1024);
+        render_state state;
+        CHECK(steady_allocations(out, fmt, engine, &state) == 0);
+        CHECK(out == "T U\n  - a: 1 (T)\n  - b: 2 (T)\n<none>\nby U\n");
+        // The thread's own state.
+        CHECK(steady_allocations(out, fmt, engine, nullptr) == 0);
+    }
+}
+
+TEST_CASE("render-state-nested")
+{
+    render_state state;
+    std::string inner;
+    object const nested
+    {
+        {"x", "X"},
+        {"lambda", lazy_value([&](ast::view const*)
+        {
+            // Renders with the same state while it's in use.
+            inner.clear();
+            render_string(inner, "[{{x}}]"_fmt(object{{"x", "Y"}}).state(state));
+            return inner;
+        })}
+    };
+    std::string out;
+    render_string(out, "{{x}}{{lambda}}{{x}}"_fmt(nested).state(state));
+    CHECK(out == "X[Y]X");
+}
@@ -81,6 +81,7 @@ TEST_CASE("fmt-spec")
     CHECK(to_string("{{i:8}}"_fmt(s)) == "      42");
     CHECK(to_string("{{f:.2f}}"_fmt(s)) == "3.14");
     CHECK(to_string("{{s:*>10}}"_fmt(s)) == "*****hello");
+    CHECK(to_string("{{i:4}}|{{s}}|{{i:<3}}|"_fmt(s)) == "  42|hello|42 |");
 }
 
 TEST_CASE("section-alias")
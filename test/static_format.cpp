@@ -0,0 +1,115 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include <catch2/catch_test_macros.hpp>
+#include <bustache/static_format.hpp>
+#include <bustache/render/string.hpp>
+#include "model.hpp"
+
+using namespace bustache;
+using namespace test;
+
+namespace
+{
+    object const data
+    {
+        {"a", "A"},
+        {"b", object{{"c", "C"}}},
+        {"list", array{1, 2, 3}},
+        {"html", "<b>"},
+        {"n", 42},
+        {"name", "p"}
+    };
+
+    context const partials
+    {
+        {"p", "[{{a}}]\n"_sfmt},
+        {"layout", "<{{$body}}default{{/body}}|{{$foot}}-{{/foot}}>"_fmt}
+    };
+
+    std::string render(format const& fmt)
+    {
+        return to_string(fmt(data).context(partials).escape(escape_html));
+    }
+
+    // Byte-wise, none of the nodes has padding.
+    template<class T, class A, class B>
+    bool same_nodes(std::vector<T, A> const& a, std::vector<T, B> const& b)
+    {
+        static_assert(std::has_unique_object_representations_v<T>);
+        return a.size() == b.size() && (a.empty() || !std::memcmp(a.data(), b.data(), a.size() * sizeof(T)));
+    }
+
+    // The documents are the same node for node, not only in what they render.
+    void check_document(ast::document const& a, ast::document const& b)
+    {
+        auto const& x = a.ctx;
+        auto const& y = b.ctx;
+        CHECK(same_nodes(a.contents, b.contents));
+        CHECK(std::ranges::equal(x.texts, y.texts));
+        CHECK(same_nodes(x.variables, y.variables));
+        CHECK(same_nodes(x.blocks, y.blocks));
+        CHECK(same_nodes(x.partials, y.partials));
+        CHECK(std::ranges::equal(x.overriders, y.overriders, [](auto const& m, auto const& n) { return same_nodes(m, n); }));
+        CHECK(same_nodes(x.lists, y.lists));
+        CHECK(same_nodes(x.paths, y.paths));
+        CHECK(x.key_chars == y.key_chars);
+        CHECK(same_nodes(x.key_ends, y.key_ends));
+        CHECK(same_nodes(x.text_newlines, y.text_newlines));
+        CHECK(same_nodes(x.newlines, y.newlines));
+    }
+
+    template<fixed_string Source>
+    void check()
+    {
+        INFO(Source.view());
+        format const runtime(Source.view());
+        check_document(static_format<Source>::get().doc(), runtime.doc());
+        CHECK(render(static_format<Source>::get()) == render(runtime));
+    }
+
+    // The nodes are laid out at compile time.
+    using sample = static_format<"a{{b.c}}{{#d}}e{{/d}}">;
+    static_assert(sample::document.texts.size() == 2);
+    static_assert(sample::document.variables.size() == 1);
+    static_assert(sample::document.blocks.size() == 1);
+    static_assert(sample::document.paths.size() == 3);
+    static_assert(sample::document.contents.size() == 3);
+}
+
+TEST_CASE("static-format-matches-runtime")
+{
+    check<"">();
+    check<"plain text only">();
+    check<"Hello {{a}} and {{{html}}} and {{&html}}!">();
+    check<"{{#b}}\n  {{c}}\n{{/b}}\n">();
+    check<"  {{#list}}\n  - {{.}}\n  {{/list}}\n">();
+    check<"{{^missing}}none{{/missing}}{{?n}}yes{{/n}}{{*list}}<{{.}}>{{/list}}">();
+    check<"{{=<% %>=}}<%a%> {{a}} <%={{ }}=%>{{a}}">();
+    check<"line\n  {{>p}}\nend">();
+    check<"{{>*name}}">();
+    check<"{{<layout}}\n{{$body}}override {{a}}{{/body}}\n{{$body}}ignored{{/body}}\n{{/layout}}">();
+    check<"{{b.c}} {{#b}}{{.c}}{{/b}} {{n:>5}}|{{a}}">();
+    check<"{{#list}}{{.}},{{/list}}\r\n{{/}}ignored">();
+    check<"{{! a comment }}\n  {{! standalone }}\nx{{#b}}{{#c}}unclosed">();
+    check<"  {{@k}}\n  x\n  {{/k}}\n">();
+    check<"{{<layout}}{{$body}}a{{$inner}}b{{/inner}}{{/body}}{{/layout}}">();
+    check<"{{<layout}}\n{{=<% %>=}}\n<%$body%>x<%/body%>\n<%/layout%>">();
+    check<"{{a:*^5}} {{#list:item}}{{item}}{{/list}}">();
+}
+
+TEST_CASE("static-format-literal")
+{
+    auto const fmt = "{{a}}-{{b.c}}"_sfmt;
+    CHECK(to_string(fmt(data)) == "A-C");
+    CHECK(&static_cast<format const&>(fmt) == &decltype(fmt)::get());
+    // Texts refer to the source in place.
+    auto const text = decltype(fmt)::get().doc().ctx.texts[0];
+    CHECK(text.data() == decltype(fmt)::source().data() + 5);
+}
@@ -0,0 +1,95 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2014-2023 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#include <catch2/catch_test_macros.hpp>
+#include <bustache/template_set.hpp>
+#include <bustache/render/string.hpp>
+#include <fstream>
+#include <random>
+#include <chrono>
+#include "model.hpp"
+
+using namespace bustache;
+using namespace test;
+
+namespace
+{
+    struct temp_dir
+    {
+        std::filesystem::path root;
+
+        static std::string unique_suffix()
+        {
+            auto const now = std::chrono::steady_clock::now().time_since_epoch().count();
+            return '_' + std::to_string(std::random_device{}()) + '_' + std::to_string(now);
+        }
+
+        // Unique to each run, so concurrent runs don't collide.
+        explicit temp_dir(char const* name)
+          : root(std::filesystem::temp_directory_path() / (name + unique_suffix()))
+        {
+            std::filesystem::remove_all(root);
+            std::filesystem::create_directories(root);
+        }
+
+        ~temp_dir()
+        {
+            std::error_code ec;
+            std::filesystem::remove_all(root, ec);
+        }
+
+        void write(char const* file, std::string_view text) const
+        {
+            auto const path = root / file;
+            std::filesystem::create_directories(path.parent_path());
+            std::ofstream(path, std::ios::binary) << text;
+        }
+    };
+}
+
+TEST_CASE("template-set-load")
+{
+    temp_dir const dir("bustache_template_set_load");
+    dir.write("page.mustache", "<{{>partials/header}}|{{>item}}>");
+    dir.write("item.mustache", "{{#list}}{{.}}{{/list}}");
+    dir.write("partials/header.mustache", "{{title}}");
+    dir.write("notes.txt", "{{#ignored");
+    for (unsigned threads : {0u, 1u, 3u})
+    {
+        auto set = template_set::load(dir.root, ".mustache", threads);
+        CHECK(set.size() == 3);
+        CHECK(set.find("notes") == nullptr);
+        REQUIRE(set.find("page"));
+        object const data{{"title", "T"}, {"list", array{1, 2}}};
+        CHECK(to_string((*set.find("page"))(data).context(set)) == "<T|12>");
+        set.link();
+        CHECK(to_string((*set.find("page"))(data).context(no_context)) == "<T|12>");
+    }
+}
+
+TEST_CASE("template-set-errors")
+{
+    temp_dir const dir("bustache_template_set_errors");
+    dir.write("good.mustache", "{{a}}");
+    dir.write("b/bad1.mustache", "{{#a}}{{/b}}");
+    dir.write("bad2.mustache", "{{=<% =}}");
+    try
+    {
+        template_set::load(dir.root);
+        FAIL("no error");
+    }
+    catch (template_set_error const& e)
+    {
+        auto const& failures = e.failures();
+        REQUIRE(failures.size() == 2);
+        CHECK(failures[0].file == dir.root / "b/bad1.mustache");
+        CHECK(failures[0].code == error_section);
+        CHECK(failures[1].file == dir.root / "bad2.mustache");
+        CHECK(failures[1].code == error_baddelim);
+        CHECK(std::string_view(e.what()).find("bad1.mustache") != std::string_view::npos);
+    }
+    CHECK(template_set::load(dir.root / "b", ".none").size() == 0);
+}